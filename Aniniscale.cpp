@@ -0,0 +1,80 @@
+/*
+* Copyright (c) 2017 Dmitry Odintsov
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "Aniniscale.hpp"
+
+#include "TaskGeometry.hpp"
+
+DownscaledImage Downscale(WorkerPool& pool, const uint8_t* pixels, size_t stride,
+    uint32_t width, uint32_t height, const BlockShape& shape, uint32_t taskBlockSide)
+{
+    if (0 == shape.bands || 0 == shape.sampleBytes || 0 == shape.x || 0 == shape.y)
+    {
+        throw vips::VError("invalid block shape");
+    }
+
+    const uint32_t x_tiles = width / shape.x;
+    const uint32_t y_tiles = height / shape.y;
+
+    if (0 == x_tiles || 0 == y_tiles)
+    {
+        throw vips::VError("image is smaller than a single block");
+    }
+
+    const uint32_t pixelBytes = shape.bands * shape.sampleBytes;
+
+    DownscaledImage result;
+    result.width = x_tiles;
+    result.height = y_tiles;
+    result.bands = shape.bands;
+    result.sampleBytes = shape.sampleBytes;
+    result.pixels.resize(static_cast<size_t>(x_tiles) * y_tiles * pixelBytes);
+
+    const size_t outStride = x_tiles * pixelBytes;
+    const DominantColorKernel kernel = SelectDominantColorKernel(shape);
+
+    const TaskGeometry geometry = PlanTasks(shape, x_tiles, y_tiles, pool.WorkerCount(), taskBlockSide);
+
+    //! Handing a single task over to a worker only adds latency
+    if (geometry.x_blocks == x_tiles && geometry.y_blocks == y_tiles)
+    {
+        pool.ProcessArea(kernel, shape, pixels, stride, width, height, result.pixels.data(), outStride);
+        return result;
+    }
+
+    ProcessTasks(pool, kernel, shape, pixels, stride, x_tiles, y_tiles, result.pixels.data(), outStride, geometry);
+
+    return result;
+}
+
+vips::VImage Downscale(WorkerPool& pool, const vips::VImage& img,
+    uint32_t x_blockSize, uint32_t y_blockSize, uint32_t taskBlockSide)
+{
+    BlockShape shape;
+    shape.bands = img.bands();
+    shape.sampleBytes = vips_format_sizeof(img.format());
+    shape.x = x_blockSize;
+    shape.y = y_blockSize;
+
+    const uint8_t* pixels = reinterpret_cast<const uint8_t*>(img.data());
+
+    if (!pixels)
+    {
+        throw vips::VError();
+    }
+
+    DownscaledImage result = Downscale(pool, pixels, static_cast<size_t>(img.width()) * shape.bands * shape.sampleBytes,
+        img.width(), img.height(), shape, taskBlockSide);
+
+    //! Wrapped buffer goes away with this function, resulting image gets a copy of its own
+    return vips::VImage::new_from_memory(result.pixels.data(), result.pixels.size(),
+            result.width, result.height, result.bands, img.format())
+        .copy(vips::VImage::option()
+            ->set("interpretation", img.interpretation())
+            ->set("xres", img.xres())
+            ->set("yres", img.yres()))
+        .copy_memory();
+}
@@ -0,0 +1,75 @@
+/*
+* Copyright (c) 2017 Dmitry Odintsov
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#ifndef ANINISCALE_ANINISCALE_HPP
+#define ANINISCALE_ANINISCALE_HPP
+
+#include "DominantColor.hpp"
+#include "WorkerPool.hpp"
+
+#include <vips/vips8>
+
+#include <cstdint>
+#include <vector>
+
+//! Default maximum number of blocks along each side of a task, 0 to pick task size from cache size and worker count
+static const uint32_t s_defaultTaskBlockSide = 0;
+
+//! Downscaled image, rows are packed without padding
+struct DownscaledImage
+{
+    std::vector<uint8_t> pixels;
+
+    uint32_t width;
+    uint32_t height;
+    uint32_t bands;
+    uint32_t sampleBytes;
+};
+
+/** @brief  Downscales pixel buffer by reducing every block to its dominant color
+ *
+ *  Images that fit into a single task are processed on the calling thread,
+ *  bigger ones are split into tasks planned by PlanTasks() and run on @p pool.
+ *
+ *  Pixels past the last whole block on either axis are ignored.
+ *
+ *  @attention  shall not be called from a task running on @p pool
+ *
+ *  @param  pool            workers to run on
+ *  @param  pixels          top left pixel of the image
+ *  @param  stride          distance between image rows in bytes
+ *  @param  width           image width in pixels
+ *  @param  height          image height in pixels
+ *  @param  shape           block geometry and pixel layout
+ *  @param  taskBlockSide   maximum number of blocks along each side of a task, 0 to pick automatically
+ *
+ *  @throws vips::VError if image is smaller than a single block or shape is invalid
+ */
+DownscaledImage Downscale(WorkerPool& pool, const uint8_t* pixels, size_t stride,
+    uint32_t width, uint32_t height, const BlockShape& shape,
+    uint32_t taskBlockSide = s_defaultTaskBlockSide);
+
+/** @brief  Downscales libvips image by reducing every block to its dominant color
+ *
+ *  Image is decoded into memory as a whole first
+ *
+ *  @attention  shall not be called from a task running on @p pool
+ *
+ *  @param  pool            workers to run on
+ *  @param  img             image of any band count and sample format
+ *  @param  x_blockSize     block size on X axis
+ *  @param  y_blockSize     block size on Y axis
+ *  @param  taskBlockSide   maximum number of blocks along each side of a task, 0 to pick automatically
+ *
+ *  @return image owning its pixels, with format and interpretation of @p img
+ *
+ *  @throws vips::VError if image can't be decoded or is smaller than a single block
+ */
+vips::VImage Downscale(WorkerPool& pool, const vips::VImage& img,
+    uint32_t x_blockSize, uint32_t y_blockSize,
+    uint32_t taskBlockSide = s_defaultTaskBlockSide);
+
+#endif // ANINISCALE_ANINISCALE_HPP
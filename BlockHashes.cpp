@@ -0,0 +1,116 @@
+/*
+* Copyright (c) 2017 Dmitry Odintsov
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "BlockHashes.hpp"
+
+#include "Hash.hpp"
+
+#include <cstring>
+#include <fstream>
+
+//! Identifies block hash files, last character is format version
+static const char s_magic[8] = { 'A', 'N', 'I', 'B', 'L', 'O', 'C', '2' };
+
+namespace
+{
+
+//! Fixed size part of the file, followed by block hashes
+struct Header
+{
+    char magic[sizeof(s_magic)];
+
+    uint32_t width;
+    uint32_t height;
+    BlockShape shape;
+
+    uint64_t encoding;
+    uint64_t output;
+    uint64_t blockCount;
+};
+
+} // namespace
+
+bool BlockHashes::SameGeometry(const BlockHashes& other) const
+{
+    return width == other.width && height == other.height &&
+        shape.bands == other.shape.bands && shape.sampleBytes == other.shape.sampleBytes &&
+        shape.x == other.shape.x && shape.y == other.shape.y;
+}
+
+void HashBlocks(WorkerPool& pool, const uint8_t* pixels, size_t stride, BlockHashes& hashes)
+{
+    const uint32_t x_tiles = hashes.width / hashes.shape.x;
+    const uint32_t y_tiles = hashes.height / hashes.shape.y;
+    const size_t blockRowBytes = static_cast<size_t>(hashes.shape.x) * hashes.shape.bands * hashes.shape.sampleBytes;
+
+    hashes.blocks.resize(static_cast<size_t>(x_tiles) * y_tiles);
+
+    //! One task per row of blocks, so every task reads a contiguous band of the image
+    pool.Run(y_tiles, [&](WorkerPool&, uint32_t y){
+        const uint8_t* blockRow = pixels + static_cast<size_t>(y) * hashes.shape.y * stride;
+        uint64_t* hash = hashes.blocks.data() + static_cast<size_t>(y) * x_tiles;
+
+        for (uint32_t x = 0; x < x_tiles; ++x)
+        {
+            uint64_t blockHash = 0;
+
+            for (uint32_t row = 0; row < hashes.shape.y; ++row)
+            {
+                blockHash = HashBytes(blockRow + row * stride + x * blockRowBytes, blockRowBytes, blockHash);
+            }
+
+            hash[x] = blockHash;
+        }
+    });
+}
+
+bool LoadBlockHashes(const std::string& path, BlockHashes& hashes)
+{
+    std::ifstream file(path.c_str(), std::ios::binary);
+    Header header;
+
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        0 != memcmp(header.magic, s_magic, sizeof(s_magic)))
+    {
+        return false;
+    }
+
+    hashes.width = header.width;
+    hashes.height = header.height;
+    hashes.shape = header.shape;
+    hashes.encoding = header.encoding;
+    hashes.output = header.output;
+
+    //! Count is checked against geometry before anything is allocated
+    if (0 == hashes.shape.x || 0 == hashes.shape.y ||
+        header.blockCount != static_cast<uint64_t>(hashes.width / hashes.shape.x) * (hashes.height / hashes.shape.y))
+    {
+        return false;
+    }
+
+    hashes.blocks.resize(header.blockCount);
+
+    return static_cast<bool>(file.read(reinterpret_cast<char*>(hashes.blocks.data()),
+        hashes.blocks.size() * sizeof(uint64_t)));
+}
+
+bool SaveBlockHashes(const std::string& path, const BlockHashes& hashes)
+{
+    Header header;
+    memcpy(header.magic, s_magic, sizeof(s_magic));
+    header.width = hashes.width;
+    header.height = hashes.height;
+    header.shape = hashes.shape;
+    header.encoding = hashes.encoding;
+    header.output = hashes.output;
+    header.blockCount = hashes.blocks.size();
+
+    std::ofstream file(path.c_str(), std::ios::binary | std::ios::trunc);
+
+    return file.write(reinterpret_cast<const char*>(&header), sizeof(header)) &&
+        file.write(reinterpret_cast<const char*>(hashes.blocks.data()), hashes.blocks.size() * sizeof(uint64_t)) &&
+        file.flush();
+}
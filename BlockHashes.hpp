@@ -0,0 +1,62 @@
+/*
+* Copyright (c) 2017 Dmitry Odintsov
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#ifndef ANINISCALE_BLOCK_HASHES_HPP
+#define ANINISCALE_BLOCK_HASHES_HPP
+
+#include "DominantColor.hpp"
+#include "WorkerPool.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/** @brief  Hashes of every input block, kept next to the output for incremental runs
+ *
+ *  Blocks whose hash did not change since the output was saved still have
+ *  the same dominant color, so only the others need to be processed again.
+ */
+struct BlockHashes
+{
+    //! Input geometry the hashes were computed for
+    uint32_t width = 0;
+    uint32_t height = 0;
+    BlockShape shape = BlockShape();
+
+    //! Hash of encoder settings the output was saved with
+    uint64_t encoding = 0;
+
+    //! Hash of output pixels saved together with these hashes
+    uint64_t output = 0;
+
+    //! One hash per block, row by row
+    std::vector<uint64_t> blocks;
+
+    //! Checks whether hashes were computed for the same geometry as @p other
+    bool SameGeometry(const BlockHashes& other) const;
+};
+
+/** @brief  Hashes every whole block of an image loaded to memory, on @p pool
+ *
+ *  @param  pixels  top left pixel of the image
+ *  @param  stride  distance between image rows in bytes
+ *  @param  hashes  its geometry is used, blocks are filled
+ */
+void HashBlocks(WorkerPool& pool, const uint8_t* pixels, size_t stride, BlockHashes& hashes);
+
+/** @brief  Reads hashes saved by SaveBlockHashes()
+ *
+ *  @return false if file is missing or malformed
+ */
+bool LoadBlockHashes(const std::string& path, BlockHashes& hashes);
+
+/** @brief  Writes hashes to a file, replacing it
+ *
+ *  @return false if file can't be written
+ */
+bool SaveBlockHashes(const std::string& path, const BlockHashes& hashes);
+
+#endif // ANINISCALE_BLOCK_HASHES_HPP
@@ -0,0 +1,96 @@
+/*
+* Copyright (c) 2017 Dmitry Odintsov
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#ifndef ANINISCALE_BOUNDED_QUEUE_HPP
+#define ANINISCALE_BOUNDED_QUEUE_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+/** @brief  FIFO handing items from one pipeline stage to another
+ *
+ *  Producer blocks while the queue is full, so a fast stage can't run
+ *  away from a slow one and pile up items in memory.
+ */
+template <typename T>
+class BoundedQueue
+{
+public:
+    /** @brief  Constructor
+     *
+     *  @param  capacity    maximum number of items waiting in queue
+     */
+    explicit BoundedQueue(size_t capacity)
+        : m_capacity(capacity)
+        , m_closed(false)
+    {
+
+    }
+
+    /** @brief  Adds an item, waits while queue is full
+     *
+     *  @return false if queue was closed and item was not added
+     */
+    bool Push(const T& item)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_notFull.wait(lock, [this]{ return m_closed || m_items.size() < m_capacity; });
+
+        if (m_closed)
+        {
+            return false;
+        }
+
+        m_items.push_back(item);
+        m_notEmpty.notify_one();
+
+        return true;
+    }
+
+    /** @brief  Takes an item, waits while queue is empty
+     *
+     *  @return false if queue was closed and no items are left
+     */
+    bool Pop(T& item)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_notEmpty.wait(lock, [this]{ return m_closed || !m_items.empty(); });
+
+        if (m_items.empty())
+        {
+            return false;
+        }
+
+        item = m_items.front();
+        m_items.pop_front();
+        m_notFull.notify_one();
+
+        return true;
+    }
+
+    //! Wakes everyone up, no more items are accepted
+    void Close()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed = true;
+
+        m_notFull.notify_all();
+        m_notEmpty.notify_all();
+    }
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_notFull;
+    std::condition_variable m_notEmpty;
+
+    std::deque<T> m_items;
+    size_t m_capacity;
+    bool m_closed;
+};
+
+#endif // ANINISCALE_BOUNDED_QUEUE_HPP
@@ -0,0 +1,71 @@
+/*
+* Copyright (c) 2017 Dmitry Odintsov
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "ColorHistogram.hpp"
+
+#include <algorithm>
+
+template <typename Color>
+BasicColorHistogram<Color>::BasicColorHistogram()
+    : m_stamp(1)
+    , m_used(0)
+    , m_mask(0)
+    , m_shift(32)
+    , m_blockPixels(0)
+    , m_linear(true)
+{
+
+}
+
+template <typename Color>
+void BasicColorHistogram<Color>::Reserve(uint32_t blockPixels)
+{
+    if (blockPixels == m_blockPixels)
+    {
+        return;
+    }
+
+    m_blockPixels = blockPixels;
+    m_linear = blockPixels <= s_linearScanLimit;
+    m_used = 0;
+
+    if (m_linear)
+    {
+        m_colors.assign(blockPixels, Color());
+        m_counts.assign(blockPixels, 0);
+        m_stamps.clear();
+
+        return;
+    }
+
+    //! Keep the table at most half full so probe chains stay short
+    uint32_t bits = 1;
+
+    while ((1u << bits) < blockPixels * 2)
+    {
+        ++bits;
+    }
+
+    m_mask = (1u << bits) - 1;
+    m_shift = 32 - bits;
+
+    m_colors.assign(m_mask + 1, Color());
+    m_counts.assign(m_mask + 1, 0);
+    m_stamps.resize(m_mask + 1);
+
+    ClearStamps();
+}
+
+template <typename Color>
+void BasicColorHistogram<Color>::ClearStamps()
+{
+    std::fill(m_stamps.begin(), m_stamps.end(), 0);
+    m_stamp = 1;
+}
+
+template class BasicColorHistogram<uint32_t>;
+template class BasicColorHistogram<uint64_t>;
+template class BasicColorHistogram<PixelColor>;
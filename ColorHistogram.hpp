@@ -0,0 +1,210 @@
+/*
+* Copyright (c) 2017 Dmitry Odintsov
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#ifndef ANINISCALE_COLOR_HISTOGRAM_HPP
+#define ANINISCALE_COLOR_HISTOGRAM_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/** @brief  Color of a pixel too wide to be packed into an integer
+ *
+ *  Refers to the pixel itself, so it is only valid while the block is
+ */
+struct PixelColor
+{
+    const uint8_t* pixel;
+    uint32_t bytes;
+
+    bool operator==(const PixelColor& other) const
+    {
+        return 0 == memcmp(pixel, other.pixel, bytes);
+    }
+
+    bool operator!=(const PixelColor& other) const
+    {
+        return !(*this == other);
+    }
+};
+
+//! Packed color types for pixels of given size in bytes
+template <uint32_t Bytes, bool Narrow = (Bytes <= 4), bool Wide = (Bytes <= 8)>
+struct PackedColor
+{
+    typedef PixelColor Type;
+};
+
+template <uint32_t Bytes, bool Wide>
+struct PackedColor<Bytes, true, Wide>
+{
+    typedef uint32_t Type;
+};
+
+template <uint32_t Bytes>
+struct PackedColor<Bytes, false, true>
+{
+    typedef uint64_t Type;
+};
+
+/** @brief  Counts color votes inside a single block
+ *
+ *  Meant to be created once per worker and reused for every block it
+ *  processes: Reset() forgets collected votes without releasing memory.
+ *
+ *  Small blocks are counted with a linear scan over the colors met so far,
+ *  bigger ones use an open-addressed hash table sized for the block.
+ *
+ *  @tparam Color   uint32_t for pixels up to 4 bytes, uint64_t for pixels
+ *                  up to 8 bytes, PixelColor for anything wider
+ */
+template <typename Color>
+class BasicColorHistogram
+{
+public:
+    //! Blocks with at most this many pixels are counted with a linear scan
+    static const uint32_t s_linearScanLimit = 16;
+
+    BasicColorHistogram();
+
+    /** @brief  Prepares histogram for blocks of given size
+     *
+     *  Does nothing if histogram is already prepared for this size
+     *
+     *  @param  blockPixels number of pixels in one block
+     */
+    void Reserve(uint32_t blockPixels);
+
+    //! Forgets all votes collected so far
+    void Reset()
+    {
+        m_used = 0;
+
+        if (!m_linear && ++m_stamp == 0)
+        {
+            ClearStamps();
+        }
+    }
+
+    /** @brief  Adds a vote for a color
+     *
+     *  @param  color   packed color value
+     *
+     *  @return number of votes for @p color including this one
+     */
+    uint32_t Vote(const Color& color)
+    {
+        return m_linear ? VoteLinear(color) : VoteHashed(color);
+    }
+
+private:
+    uint32_t VoteLinear(const Color& color)
+    {
+        for (uint32_t i = 0; i < m_used; ++i)
+        {
+            if (m_colors[i] == color)
+            {
+                return ++m_counts[i];
+            }
+        }
+
+        m_colors[m_used] = color;
+        m_counts[m_used] = 1;
+        ++m_used;
+
+        return 1;
+    }
+
+    uint32_t VoteHashed(const Color& color)
+    {
+        //! Fibonacci hashing spreads neighbouring colors over the table
+        uint32_t slot = (Fold(color) * 2654435769u) >> m_shift;
+
+        while (true)
+        {
+            if (m_stamps[slot] != m_stamp)
+            {
+                m_stamps[slot] = m_stamp;
+                m_colors[slot] = color;
+                m_counts[slot] = 1;
+
+                return 1;
+            }
+
+            if (m_colors[slot] == color)
+            {
+                return ++m_counts[slot];
+            }
+
+            slot = (slot + 1) & m_mask;
+        }
+    }
+
+    //! Reduces color to 32 bits for hashing
+    static uint32_t Fold(uint32_t color)
+    {
+        return color;
+    }
+
+    static uint32_t Fold(uint64_t color)
+    {
+        return static_cast<uint32_t>((color * 0x9E3779B97F4A7C15ull) >> 32);
+    }
+
+    static uint32_t Fold(const PixelColor& color)
+    {
+        uint64_t hash = 0;
+
+        for (uint32_t offset = 0; offset < color.bytes; offset += sizeof(uint64_t))
+        {
+            uint64_t chunk = 0;
+            memcpy(&chunk, color.pixel + offset, std::min<uint32_t>(sizeof(chunk), color.bytes - offset));
+
+            hash = (hash ^ chunk) * 0x9E3779B97F4A7C15ull;
+        }
+
+        return static_cast<uint32_t>(hash >> 32);
+    }
+
+    //! Marks every hash table slot as empty
+    void ClearStamps();
+
+    //! Colors met in current block
+    std::vector<Color> m_colors;
+
+    //! Votes for each color in @p m_colors
+    std::vector<uint32_t> m_counts;
+
+    //! Generation of each hash table slot, slot is empty unless it matches @p m_stamp
+    std::vector<uint32_t> m_stamps;
+
+    //! Current generation
+    uint32_t m_stamp;
+
+    //! Number of colors in @p m_colors, used by linear scan only
+    uint32_t m_used;
+
+    //! Hash table index mask and hash shift
+    uint32_t m_mask;
+    uint32_t m_shift;
+
+    //! Block size histogram is prepared for
+    uint32_t m_blockPixels;
+
+    //! Whether linear scan is used instead of hash table
+    bool m_linear;
+};
+
+//! Histogram of pixels up to 4 bytes, the one every 8-bit kernel uses
+typedef BasicColorHistogram<uint32_t> ColorHistogram;
+
+//! Instantiated in ColorHistogram.cpp
+extern template class BasicColorHistogram<uint32_t>;
+extern template class BasicColorHistogram<uint64_t>;
+extern template class BasicColorHistogram<PixelColor>;
+
+#endif // ANINISCALE_COLOR_HISTOGRAM_HPP
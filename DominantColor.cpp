@@ -0,0 +1,339 @@
+/*
+* Copyright (c) 2017 Dmitry Odintsov
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "DominantColor.hpp"
+
+#include <cstring>
+
+namespace
+{
+
+//! Packs pixel of @p bytes bytes into a color
+inline void PackColor(const uint8_t* pixel, uint32_t bytes, uint32_t& color)
+{
+    color = 0;
+
+    for (uint32_t b = 0; b < bytes; ++b)
+    {
+        color |= static_cast<uint32_t>(pixel[b]) << ((bytes - 1 - b) * 8);
+    }
+}
+
+inline void PackColor(const uint8_t* pixel, uint32_t bytes, uint64_t& color)
+{
+    color = 0;
+    memcpy(&color, pixel, bytes);
+}
+
+inline void PackColor(const uint8_t* pixel, uint32_t bytes, PixelColor& color)
+{
+    color.pixel = pixel;
+    color.bytes = bytes;
+}
+
+/** @brief  Returns histogram for colors of given type, prepared for blocks of @p blockPixels
+ *
+ *  Pixels up to 4 bytes are counted in the histogram kernel was given,
+ *  wider colors use a histogram of their own kept per thread
+ */
+template <typename Color>
+BasicColorHistogram<Color>& Histogram(ColorHistogram&, uint32_t blockPixels)
+{
+    static thread_local BasicColorHistogram<Color> colors;
+    colors.Reserve(blockPixels);
+
+    return colors;
+}
+
+template <>
+ColorHistogram& Histogram<uint32_t>(ColorHistogram& colors, uint32_t)
+{
+    return colors;
+}
+
+//! DominantColorScalar() for colors of given type
+template <typename Color>
+const uint8_t* DominantColorPacked(const uint8_t* block, size_t stride,
+    const BlockShape& shape, BasicColorHistogram<Color>& colors)
+{
+    const uint32_t pixelBytes = shape.bands * shape.sampleBytes;
+
+    //! Calculate color threshold - if color has this much, no other color can collect more
+    const uint32_t size = shape.x * shape.y;
+    const uint32_t win = size - size / 2;
+
+    colors.Reset();
+    const uint8_t* dominant = block;
+    uint32_t domCount = 0;
+
+    //! Iterate over all pixels in original area
+    for (uint32_t areaY = 0; areaY < shape.y; ++areaY)
+    {
+        for (uint32_t areaX = 0; areaX < shape.x; ++areaX)
+        {
+            // Get current pixel data
+            const uint8_t* pixel = block + areaY * stride + areaX * pixelBytes;
+
+            //! Get color value
+            Color color;
+            PackColor(pixel, pixelBytes, color);
+
+            //! Increase the number of votes for that color and check if it's dominating
+            const uint32_t votes = colors.Vote(color);
+
+            if (domCount < votes)
+            {
+                domCount = votes;
+                dominant = pixel;
+
+                //! The rest of the block can't change the result
+                if (domCount >= win)
+                {
+                    return dominant;
+                }
+            }
+        }
+    }
+
+    return dominant;
+}
+
+/** @brief  DominantColorScalar() with sample type, band count and block shape known at compile time
+ *
+ *  Loops are fully unrolled, blocks small enough for a linear scan keep
+ *  their votes in a local array instead of the shared histogram.
+ */
+template <typename Sample, uint32_t Bands, uint32_t BX, uint32_t BY>
+const uint8_t* DominantColorFixed(const uint8_t* block, size_t stride,
+    const BlockShape&, ColorHistogram& histogram)
+{
+    typedef typename PackedColor<sizeof(Sample) * Bands>::Type Color;
+
+    const uint32_t pixelBytes = sizeof(Sample) * Bands;
+    const uint32_t size = BX * BY;
+    const uint32_t win = size - size / 2;
+    const bool local = size <= ColorHistogram::s_linearScanLimit;
+
+    Color palette[size];
+    uint32_t counts[size];
+    uint32_t used = 0;
+
+    BasicColorHistogram<Color>* colors = 0;
+
+    if (!local)
+    {
+        colors = &Histogram<Color>(histogram, size);
+        colors->Reset();
+    }
+
+    const uint8_t* dominant = block;
+    uint32_t domCount = 0;
+
+    for (uint32_t areaY = 0; areaY < BY; ++areaY)
+    {
+        for (uint32_t areaX = 0; areaX < BX; ++areaX)
+        {
+            const uint8_t* pixel = block + areaY * stride + areaX * pixelBytes;
+
+            Color color;
+            PackColor(pixel, pixelBytes, color);
+
+            uint32_t votes = 0;
+
+            if (local)
+            {
+                uint32_t slot = 0;
+
+                while (slot < used && palette[slot] != color)
+                {
+                    ++slot;
+                }
+
+                if (slot == used)
+                {
+                    palette[used] = color;
+                    counts[used] = 0;
+                    ++used;
+                }
+
+                votes = ++counts[slot];
+            }
+            else
+            {
+                votes = colors->Vote(color);
+            }
+
+            if (domCount < votes)
+            {
+                domCount = votes;
+                dominant = pixel;
+
+                //! The rest of the block can't change the result
+                if (domCount >= win)
+                {
+                    return dominant;
+                }
+            }
+        }
+    }
+
+    return dominant;
+}
+
+//! Specialized kernel together with the shape it handles
+struct FixedKernel
+{
+    uint32_t bands;
+    uint32_t sampleBytes;
+    uint32_t x;
+    uint32_t y;
+    DominantColorKernel kernel;
+};
+
+#define ANINISCALE_FIXED_KERNELS(Sample, side) \
+    { 1, sizeof(Sample), side, side, &DominantColorFixed<Sample, 1, side, side> }, \
+    { 3, sizeof(Sample), side, side, &DominantColorFixed<Sample, 3, side, side> }, \
+    { 4, sizeof(Sample), side, side, &DominantColorFixed<Sample, 4, side, side> }
+
+//! Block shapes and sample types worth compiling a dedicated kernel for
+const FixedKernel s_fixedKernels[] = {
+    ANINISCALE_FIXED_KERNELS(uint8_t, 2),
+    ANINISCALE_FIXED_KERNELS(uint8_t, 4),
+    ANINISCALE_FIXED_KERNELS(uint8_t, 8),
+    ANINISCALE_FIXED_KERNELS(uint8_t, 16),
+    ANINISCALE_FIXED_KERNELS(uint16_t, 2),
+    ANINISCALE_FIXED_KERNELS(uint16_t, 4),
+    ANINISCALE_FIXED_KERNELS(uint16_t, 8),
+    ANINISCALE_FIXED_KERNELS(uint16_t, 16),
+    ANINISCALE_FIXED_KERNELS(float, 2),
+    ANINISCALE_FIXED_KERNELS(float, 4),
+    ANINISCALE_FIXED_KERNELS(float, 8),
+    ANINISCALE_FIXED_KERNELS(float, 16)
+};
+
+#undef ANINISCALE_FIXED_KERNELS
+
+} // namespace
+
+const uint8_t* DominantColorScalar(const uint8_t* block, size_t stride,
+    const BlockShape& shape, ColorHistogram& colors)
+{
+    const uint32_t pixelBytes = shape.bands * shape.sampleBytes;
+    const uint32_t blockPixels = shape.x * shape.y;
+
+    //! Pick the narrowest color that holds the whole pixel
+    if (pixelBytes <= 4)
+    {
+        return DominantColorPacked(block, stride, shape, colors);
+    }
+
+    if (pixelBytes <= 8)
+    {
+        return DominantColorPacked(block, stride, shape, Histogram<uint64_t>(colors, blockPixels));
+    }
+
+    return DominantColorPacked(block, stride, shape, Histogram<PixelColor>(colors, blockPixels));
+}
+
+const uint8_t* DominantColorIndexed(const uint8_t* block, size_t stride,
+    const BlockShape& shape, ColorHistogram&)
+{
+    //! Votes for every index, back to zero after every block
+    static thread_local uint32_t counts[256] = {};
+
+    //! Indices met in current block, their counts are cleared once it is done
+    uint8_t met[256];
+    uint32_t metCount = 0;
+
+    const uint32_t size = shape.x * shape.y;
+    const uint32_t win = size - size / 2;
+
+    const uint8_t* dominant = block;
+    uint32_t domCount = 0;
+
+    for (uint32_t areaY = 0; areaY < shape.y && domCount < win; ++areaY)
+    {
+        const uint8_t* row = block + areaY * stride;
+
+        for (uint32_t areaX = 0; areaX < shape.x; ++areaX)
+        {
+            const uint8_t index = row[areaX];
+            const uint32_t votes = ++counts[index];
+
+            if (votes == 1)
+            {
+                met[metCount++] = index;
+            }
+
+            if (domCount < votes)
+            {
+                domCount = votes;
+                dominant = row + areaX;
+
+                //! The rest of the block can't change the result
+                if (domCount >= win)
+                {
+                    break;
+                }
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < metCount; ++i)
+    {
+        counts[met[i]] = 0;
+    }
+
+    return dominant;
+}
+
+DominantColorKernel SpecializedDominantColorKernel(const BlockShape& shape)
+{
+    for (const FixedKernel& fixed : s_fixedKernels)
+    {
+        if (fixed.bands == shape.bands && fixed.sampleBytes == shape.sampleBytes &&
+            fixed.x == shape.x && fixed.y == shape.y)
+        {
+            return fixed.kernel;
+        }
+    }
+
+    return 0;
+}
+
+DominantColorKernel SelectDominantColorKernel(const BlockShape& shape)
+{
+    //! Unrolled kernels beat runtime ones for every shape they cover
+    DominantColorKernel specialized = SpecializedDominantColorKernel(shape);
+
+    if (specialized)
+    {
+        return specialized;
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    //! Linear color lookup stops paying off on bigger noisy blocks
+    const bool simdShape = shape.sampleBytes == 1 && (shape.bands == 3 || shape.bands == 4) &&
+        shape.x * shape.y <= s_simdPreferredPixels;
+
+    if (simdShape)
+    {
+        __builtin_cpu_init();
+
+        if (__builtin_cpu_supports("avx2"))
+        {
+            return &DominantColorAvx2;
+        }
+
+        if (__builtin_cpu_supports("sse4.2"))
+        {
+            return &DominantColorSse42;
+        }
+    }
+#endif
+
+    return &DominantColorScalar;
+}
@@ -0,0 +1,102 @@
+/*
+* Copyright (c) 2017 Dmitry Odintsov
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#ifndef ANINISCALE_DOMINANT_COLOR_HPP
+#define ANINISCALE_DOMINANT_COLOR_HPP
+
+#include "ColorHistogram.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+//! Describes blocks of pixels reduced to a single pixel
+struct BlockShape
+{
+    //! Image band count
+    uint32_t bands;
+
+    //! Size of a single band sample in bytes, samples are compared bit for bit
+    uint32_t sampleBytes;
+
+    //! Block size
+    uint32_t x;
+    uint32_t y;
+};
+
+/** @brief  Returns number of votes that makes a color dominant in any pixel order
+ *
+ *  Color with more than half of the votes of a block is the only one that
+ *  can end the search early, and no other color can catch up with it, so
+ *  the result can be told from vote counts alone.
+ */
+inline uint32_t DecisiveVotes(const BlockShape& shape)
+{
+    return shape.x * shape.y / 2 + 1;
+}
+
+/** @brief  Finds dominant color of a single block
+ *
+ *  Pixels are voted for row by row, color that collects the most
+ *  votes first wins. Search ends as soon as a color has at least half
+ *  of the votes, no other color can collect more.
+ *
+ *  @param  block   first pixel of the block
+ *  @param  stride  distance between block rows in bytes
+ *  @param  shape   block geometry
+ *  @param  colors  histogram prepared for blocks of @p shape, pixels wider than
+ *                  4 bytes are counted in a per-thread histogram of wider colors
+ *
+ *  @return pointer to a pixel of dominant color inside the block
+ */
+typedef const uint8_t* (*DominantColorKernel)(const uint8_t* block, size_t stride,
+    const BlockShape& shape, ColorHistogram& colors);
+
+//! Largest block (in pixels) handled by SIMD kernels
+static const uint32_t s_simdMaxPixels = 256;
+
+//! Largest block (in pixels) SelectDominantColorKernel() picks SIMD kernels for
+static const uint32_t s_simdPreferredPixels = 64;
+
+//! Portable kernel, handles any block shape, sample type and band count
+const uint8_t* DominantColorScalar(const uint8_t* block, size_t stride,
+    const BlockShape& shape, ColorHistogram& colors);
+
+/** @brief  Kernel for index images, 1 band of 8-bit palette indices
+ *
+ *  Votes are counted in a 256 entry array, no color lookup at all.
+ */
+const uint8_t* DominantColorIndexed(const uint8_t* block, size_t stride,
+    const BlockShape& shape, ColorHistogram& colors);
+
+#if defined(__x86_64__) || defined(__i386__)
+//! SIMD kernels for 3 and 4 band blocks of 8-bit samples, at most s_simdMaxPixels pixels
+const uint8_t* DominantColorSse42(const uint8_t* block, size_t stride,
+    const BlockShape& shape, ColorHistogram& colors);
+
+const uint8_t* DominantColorAvx2(const uint8_t* block, size_t stride,
+    const BlockShape& shape, ColorHistogram& colors);
+#endif
+
+/** @brief  Looks up a kernel compiled for exactly this block shape
+ *
+ *  Specializations exist for 2x2, 4x4, 8x8 and 16x16 blocks of 1, 3 and
+ *  4 band images with 8-bit, 16-bit and 32-bit float samples
+ *
+ *  @param  shape   block geometry
+ *
+ *  @return specialized kernel or 0 if there is none for @p shape
+ */
+DominantColorKernel SpecializedDominantColorKernel(const BlockShape& shape);
+
+/** @brief  Picks the fastest kernel for given block shape on this CPU
+ *
+ *  @param  shape   block geometry
+ *
+ *  @return kernel that produces the same result as DominantColorScalar()
+ */
+DominantColorKernel SelectDominantColorKernel(const BlockShape& shape);
+
+#endif // ANINISCALE_DOMINANT_COLOR_HPP
@@ -0,0 +1,18 @@
+/*
+* Copyright (c) 2017 Dmitry Odintsov
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+//! Built with -mavx2, only called after checking CPU support at runtime
+#ifdef __AVX2__
+
+#include "DominantColorSimd.hpp"
+
+const uint8_t* DominantColorAvx2(const uint8_t* block, size_t stride,
+    const BlockShape& shape, ColorHistogram&)
+{
+    return DominantColorSimd(block, stride, shape);
+}
+
+#endif // __AVX2__
@@ -0,0 +1,198 @@
+/*
+* Copyright (c) 2017 Dmitry Odintsov
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#ifndef ANINISCALE_DOMINANT_COLOR_SIMD_HPP
+#define ANINISCALE_DOMINANT_COLOR_SIMD_HPP
+
+//! Shared body of SIMD kernels
+//
+// Included only by translation units built with matching instruction set
+// flags (-msse4.2 or -mavx2), everything here has internal linkage so
+// differently compiled copies never mix.
+
+#include "DominantColor.hpp"
+
+#include <cstring>
+#include <immintrin.h>
+
+namespace
+{
+
+#ifdef __AVX2__
+//! Number of colors compared at once
+const uint32_t s_lanes = 8;
+
+/** @brief  Looks up a color among colors met so far
+ *
+ *  @return index of @p color in @p palette or @p used if it is not there
+ */
+inline uint32_t FindColor(const uint32_t* palette, uint32_t used, uint32_t color)
+{
+    const __m256i needle = _mm256_set1_epi32(color);
+
+    for (uint32_t i = 0; i < used; i += s_lanes)
+    {
+        const __m256i candidates = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(palette + i));
+        uint32_t mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(candidates, needle)));
+
+        if (used - i < s_lanes)
+        {
+            mask &= (1u << (used - i)) - 1;
+        }
+
+        if (mask)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+
+    return used;
+}
+#else
+//! Number of colors compared at once
+const uint32_t s_lanes = 4;
+
+/** @brief  Looks up a color among colors met so far
+ *
+ *  @return index of @p color in @p palette or @p used if it is not there
+ */
+inline uint32_t FindColor(const uint32_t* palette, uint32_t used, uint32_t color)
+{
+    const __m128i needle = _mm_set1_epi32(color);
+
+    for (uint32_t i = 0; i < used; i += s_lanes)
+    {
+        const __m128i candidates = _mm_loadu_si128(reinterpret_cast<const __m128i*>(palette + i));
+        uint32_t mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(candidates, needle)));
+
+        if (used - i < s_lanes)
+        {
+            mask &= (1u << (used - i)) - 1;
+        }
+
+        if (mask)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+
+    return used;
+}
+#endif
+
+/** @brief  Packs every pixel of a block into a color value
+ *
+ *  Four pixels are loaded and rearranged in a register at a time, so
+ *  color values match the ones DominantColorScalar() builds byte by byte
+ *
+ *  @param[out] colors  block colors, row by row
+ */
+inline void PackBlock(const uint8_t* block, size_t stride, const BlockShape& shape, uint32_t* colors)
+{
+    const __m128i shuffle = shape.bands == 4
+        ? _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12)
+        : _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+
+    for (uint32_t y = 0; y < shape.y; ++y)
+    {
+        const uint8_t* row = block + y * stride;
+        uint32_t* rowColors = colors + y * shape.x;
+        uint32_t x = 0;
+
+        for (; x + 4 <= shape.x; x += 4)
+        {
+            const uint8_t* pixels = row + x * shape.bands;
+            __m128i packed;
+
+            if (shape.bands == 4)
+            {
+                packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels));
+            }
+            else
+            {
+                //! Load exactly 12 bytes so we never read past the row
+                int32_t tail;
+                std::memcpy(&tail, pixels + 8, sizeof(tail));
+                packed = _mm_insert_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(pixels)), tail, 2);
+            }
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(rowColors + x), _mm_shuffle_epi8(packed, shuffle));
+        }
+
+        for (; x < shape.x; ++x)
+        {
+            const uint8_t* pixel = row + x * shape.bands;
+            uint32_t color = 0;
+
+            for (uint32_t b = 0; b < shape.bands; ++b)
+            {
+                color |= static_cast<uint32_t>(pixel[b]) << ((shape.bands - 1 - b) * 8);
+            }
+
+            rowColors[x] = color;
+        }
+    }
+}
+
+//! Same voting as DominantColorScalar(), with colors looked up s_lanes at a time
+inline const uint8_t* DominantColorSimd(const uint8_t* block, size_t stride, const BlockShape& shape)
+{
+    uint32_t colors[s_simdMaxPixels];
+    uint32_t palette[s_simdMaxPixels + s_lanes];
+    uint32_t counts[s_simdMaxPixels];
+
+    PackBlock(block, stride, shape, colors);
+
+    const uint32_t size = shape.x * shape.y;
+    const uint32_t win = size - size / 2;
+
+    uint32_t used = 0;
+    uint32_t slot = 0;
+    uint32_t domCount = 0;
+    uint32_t domIndex = 0;
+
+    for (uint32_t areaY = 0; areaY < shape.y; ++areaY)
+    {
+        for (uint32_t areaX = 0; areaX < shape.x; ++areaX)
+        {
+            const uint32_t index = areaY * shape.x + areaX;
+            const uint32_t color = colors[index];
+
+            //! Neighbouring pixels tend to match, skip the lookup for those
+            if (used == 0 || palette[slot] != color)
+            {
+                slot = FindColor(palette, used, color);
+
+                if (slot == used)
+                {
+                    palette[used] = color;
+                    counts[used] = 0;
+                    ++used;
+                }
+            }
+
+            const uint32_t votes = ++counts[slot];
+
+            if (domCount < votes)
+            {
+                domCount = votes;
+                domIndex = index;
+
+                //! The rest of the block can't change the result
+                if (domCount >= win)
+                {
+                    return block + areaY * stride + areaX * shape.bands;
+                }
+            }
+        }
+    }
+
+    return block + (domIndex / shape.x) * stride + (domIndex % shape.x) * shape.bands;
+}
+
+} // namespace
+
+#endif // ANINISCALE_DOMINANT_COLOR_SIMD_HPP
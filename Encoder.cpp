@@ -0,0 +1,360 @@
+/*
+* Copyright (c) 2017 Dmitry Odintsov
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "Encoder.hpp"
+
+#include "Profiler.hpp"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+namespace
+{
+
+//! Format names, extensions and libvips loader names, in OutputFormat order
+struct FormatInfo
+{
+    const char* name;
+    const char* extension;
+
+    //! Part of libvips loader class name for files already in this format
+    const char* loader;
+};
+
+const FormatInfo s_formats[OUTPUT_FORMAT_UNKNOWN] = {
+    { "png", ".png", "png" },
+    { "webp", ".webp", "webp" },
+    { "ppm", ".ppm", "ppm" },
+    { "raw", ".raw", 0 },
+    { "gif", ".gif", "gif" },
+    { "tiff", ".tif", "tiff" },
+};
+
+std::string ToLower(std::string text)
+{
+    std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c){ return std::tolower(c); });
+
+    return text;
+}
+
+//! Checks whether file at @p path is already encoded as @p format
+bool IsInFormat(const std::string& path, OutputFormat format)
+{
+    const char* loader = vips_foreign_find_load(path.c_str());
+
+    if (!loader || !s_formats[format].loader)
+    {
+        return false;
+    }
+
+    return ToLower(loader).find(s_formats[format].loader) != std::string::npos;
+}
+
+//! Appends @p value to @p data, most significant byte first as PNG stores numbers
+void PutUint32(std::vector<uint8_t>& data, uint32_t value)
+{
+    for (int shift = 24; shift >= 0; shift -= 8)
+    {
+        data.push_back(static_cast<uint8_t>(value >> shift));
+    }
+}
+
+//! Writes PNG chunk: length, type, data and CRC of type and data
+void WriteChunk(std::ofstream& file, const char* type, const std::vector<uint8_t>& data)
+{
+    std::vector<uint8_t> header;
+    PutUint32(header, data.size());
+    header.insert(header.end(), type, type + 4);
+
+    uLong crc = crc32(0, reinterpret_cast<const Bytef*>(type), 4);
+
+    //! Null buffer would reset the checksum, and data of empty vector may be null
+    if (!data.empty())
+    {
+        crc = crc32(crc, data.data(), data.size());
+    }
+
+    std::vector<uint8_t> trailer;
+    PutUint32(trailer, crc);
+
+    file.write(reinterpret_cast<const char*>(header.data()), header.size());
+    file.write(reinterpret_cast<const char*>(data.data()), data.size());
+    file.write(reinterpret_cast<const char*>(trailer.data()), trailer.size());
+}
+
+} // namespace
+
+OutputFormat ParseOutputFormat(const std::string& name)
+{
+    const std::string lower = ToLower(name);
+
+    //! Every netpbm flavour is written by the same saver
+    if (lower == "pgm" || lower == "pnm")
+    {
+        return OUTPUT_FORMAT_PPM;
+    }
+
+    if (lower == "tif")
+    {
+        return OUTPUT_FORMAT_TIFF;
+    }
+
+    for (uint32_t format = 0; format < OUTPUT_FORMAT_UNKNOWN; ++format)
+    {
+        if (lower == s_formats[format].name)
+        {
+            return static_cast<OutputFormat>(format);
+        }
+    }
+
+    return OUTPUT_FORMAT_UNKNOWN;
+}
+
+OutputFormat OutputFormatFromPath(const std::string& path)
+{
+    const size_t extension = path.find_last_of('.');
+
+    if (extension == std::string::npos || path.find_first_of("/\\", extension) != std::string::npos)
+    {
+        return OUTPUT_FORMAT_UNKNOWN;
+    }
+
+    return ParseOutputFormat(path.substr(extension + 1));
+}
+
+const char* OutputFormatExtension(OutputFormat format)
+{
+    return format < OUTPUT_FORMAT_UNKNOWN ? s_formats[format].extension : "";
+}
+
+bool ParsePngFilter(const std::string& list, int& filter)
+{
+    static const struct
+    {
+        const char* name;
+        int flag;
+    } filters[] = {
+        { "none", VIPS_FOREIGN_PNG_FILTER_NONE },
+        { "sub", VIPS_FOREIGN_PNG_FILTER_SUB },
+        { "up", VIPS_FOREIGN_PNG_FILTER_UP },
+        { "avg", VIPS_FOREIGN_PNG_FILTER_AVG },
+        { "paeth", VIPS_FOREIGN_PNG_FILTER_PAETH },
+        { "all", VIPS_FOREIGN_PNG_FILTER_ALL },
+    };
+
+    filter = 0;
+
+    std::istringstream stream(ToLower(list));
+    std::string item;
+
+    while (std::getline(stream, item, ','))
+    {
+        bool found = false;
+
+        for (const auto& known : filters)
+        {
+            if (item == known.name)
+            {
+                filter |= known.flag;
+                found = true;
+            }
+        }
+
+        if (!found)
+        {
+            return false;
+        }
+    }
+
+    return filter != 0;
+}
+
+void SaveImage(const vips::VImage& img, const std::string& path, const EncoderOptions& options)
+{
+    ProfileSpan span("encode");
+
+    switch (options.format)
+    {
+        case OUTPUT_FORMAT_PNG:
+        {
+            vips::VOption* option = vips::VImage::option();
+
+            if (options.compression >= 0)
+            {
+                option->set("compression", options.compression);
+            }
+
+            if (options.pngFilter >= 0)
+            {
+                option->set("filter", options.pngFilter);
+            }
+
+            img.pngsave( (char*) path.c_str(), option );
+            break;
+        }
+        case OUTPUT_FORMAT_WEBP:
+        {
+            vips::VOption* option = vips::VImage::option()->set("lossless", true);
+
+            if (options.compression >= 0)
+            {
+                option->set("reduction_effort", std::min(options.compression, 6));
+            }
+
+            img.webpsave( (char*) path.c_str(), option );
+            break;
+        }
+        case OUTPUT_FORMAT_PPM:
+        {
+            img.ppmsave( (char*) path.c_str() );
+            break;
+        }
+        case OUTPUT_FORMAT_RAW:
+        {
+            img.rawsave( (char*) path.c_str() );
+            break;
+        }
+        case OUTPUT_FORMAT_GIF:
+        {
+            img.gifsave( (char*) path.c_str() );
+            break;
+        }
+        case OUTPUT_FORMAT_TIFF:
+        {
+            img.tiffsave( (char*) path.c_str() );
+            break;
+        }
+        default:
+        {
+            throw vips::VError("unsupported output format");
+        }
+    }
+}
+
+void SaveIndexedPng(const uint8_t* indices, uint32_t width, uint32_t height, const uint8_t* colors,
+    uint32_t colorCount, uint32_t bands, const std::string& path, const EncoderOptions& options)
+{
+    ProfileSpan span("encode");
+
+    static const uint8_t signature[] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+
+    const uint32_t depth = colorCount <= 2 ? 1 : colorCount <= 4 ? 2 : colorCount <= 16 ? 4 : 8;
+    const uint32_t perByte = 8 / depth;
+    const size_t rowBytes = (static_cast<size_t>(width) * depth + 7) / 8;
+
+    //! Every row starts with filter type, none
+    std::vector<uint8_t> raw((rowBytes + 1) * height, 0);
+
+    for (uint32_t y = 0; y < height; ++y)
+    {
+        const uint8_t* row = indices + static_cast<size_t>(y) * width;
+        uint8_t* packed = &raw[y * (rowBytes + 1) + 1];
+
+        //! Leftmost pixel goes to the most significant bits
+        for (uint32_t x = 0; x < width; ++x)
+        {
+            packed[x / perByte] |= row[x] << (8 - depth * (x % perByte + 1));
+        }
+    }
+
+    uLongf compressedSize = compressBound(raw.size());
+    std::vector<uint8_t> compressed(compressedSize);
+
+    if (Z_OK != compress2(compressed.data(), &compressedSize, raw.data(), raw.size(),
+        options.compression >= 0 ? options.compression : Z_DEFAULT_COMPRESSION))
+    {
+        throw vips::VError("unable to compress " + path);
+    }
+
+    compressed.resize(compressedSize);
+
+    std::vector<uint8_t> header;
+    PutUint32(header, width);
+    PutUint32(header, height);
+
+    //! Bit depth, palette color type, deflate, adaptive filtering, no interlace
+    header.push_back(depth);
+    header.push_back(3);
+    header.push_back(0);
+    header.push_back(0);
+    header.push_back(0);
+
+    //! Gray images repeat their sample over all three channels
+    const bool gray = bands < 3;
+    const bool alpha = bands == 2 || bands == 4;
+
+    std::vector<uint8_t> palette;
+    std::vector<uint8_t> transparency;
+
+    for (uint32_t i = 0; i < colorCount; ++i)
+    {
+        const uint8_t* color = colors + i * bands;
+
+        for (uint32_t channel = 0; channel < 3; ++channel)
+        {
+            palette.push_back(color[gray ? 0 : channel]);
+        }
+
+        if (alpha)
+        {
+            transparency.push_back(color[bands - 1]);
+        }
+    }
+
+    //! Colors past the last transparent one are opaque anyway
+    while (!transparency.empty() && transparency.back() == 255)
+    {
+        transparency.pop_back();
+    }
+
+    std::ofstream file(path.c_str(), std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+
+    WriteChunk(file, "IHDR", header);
+    WriteChunk(file, "PLTE", palette);
+
+    if (!transparency.empty())
+    {
+        WriteChunk(file, "tRNS", transparency);
+    }
+
+    WriteChunk(file, "IDAT", compressed);
+    WriteChunk(file, "IEND", std::vector<uint8_t>());
+
+    if (!file.flush())
+    {
+        throw vips::VError("unable to write " + path);
+    }
+}
+
+void SaveUnchanged(const vips::VImage& img, const std::string& in, const std::string& out,
+    const EncoderOptions& options)
+{
+    if (!IsInFormat(in, options.format))
+    {
+        SaveImage(img, out, options);
+        return;
+    }
+
+    //! Copying a file onto itself would truncate it
+    if (in == out)
+    {
+        return;
+    }
+
+    std::ifstream source(in.c_str(), std::ios::binary);
+    std::ofstream destination(out.c_str(), std::ios::binary | std::ios::trunc);
+
+    if (!source || !destination || !(destination << source.rdbuf()))
+    {
+        throw vips::VError("unable to copy " + in + " to " + out);
+    }
+}
@@ -0,0 +1,108 @@
+/*
+* Copyright (c) 2017 Dmitry Odintsov
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#ifndef ANINISCALE_ENCODER_HPP
+#define ANINISCALE_ENCODER_HPP
+
+#include <vips/vips8>
+
+#include <cstdint>
+#include <string>
+
+//! Supported output file formats
+enum OutputFormat
+{
+    OUTPUT_FORMAT_PNG,
+
+    //! Always lossless
+    OUTPUT_FORMAT_WEBP,
+
+    //! PPM for 3 band images, PGM for 1 band images
+    OUTPUT_FORMAT_PPM,
+
+    //! Pixels only, rows are packed without padding
+    OUTPUT_FORMAT_RAW,
+
+    //! Animated if image has several frames, colors are quantized to a palette of 256
+    OUTPUT_FORMAT_GIF,
+
+    //! A page per frame
+    OUTPUT_FORMAT_TIFF,
+
+    OUTPUT_FORMAT_UNKNOWN
+};
+
+//! Encoder settings, negative values leave library defaults in place
+struct EncoderOptions
+{
+    OutputFormat format = OUTPUT_FORMAT_PNG;
+
+    //! PNG zlib level 0-9, WebP effort 0-6
+    int compression = -1;
+
+    //! Combination of VipsForeignPngFilter flags
+    int pngFilter = -1;
+
+    //! Write PNG of images with few enough colors as palette indices
+    bool palette = false;
+};
+
+/** @brief  Looks up format by name or file extension, case insensitive
+ *
+ *  @return OUTPUT_FORMAT_UNKNOWN if @p name is not a supported format
+ */
+OutputFormat ParseOutputFormat(const std::string& name);
+
+/** @brief  Looks up format by extension of @p path
+ *
+ *  @return OUTPUT_FORMAT_UNKNOWN if extension is missing or not supported
+ */
+OutputFormat OutputFormatFromPath(const std::string& path);
+
+//! Returns file extension for @p format, including the dot
+const char* OutputFormatExtension(OutputFormat format);
+
+/** @brief  Parses comma separated list of PNG filters
+ *
+ *  Accepts none, sub, up, avg, paeth and all
+ *
+ *  @return false if the list contains anything else
+ */
+bool ParsePngFilter(const std::string& list, int& filter);
+
+/** @brief  Encodes image to a file
+ *
+ *  @throws vips::VError if image can't be saved
+ */
+void SaveImage(const vips::VImage& img, const std::string& path, const EncoderOptions& options);
+
+/** @brief  Writes indexed PNG straight from palette indices
+ *
+ *  Bit depth is the smallest one that holds every index. Palette of 1 and 2
+ *  band images is gray, alpha goes to the transparency chunk. Rows are not
+ *  filtered, which suits indexed images best, so filters in @p options are ignored.
+ *
+ *  @param  indices     one byte per pixel, rows are packed without padding
+ *  @param  colors      palette colors one after another, @p bands 8-bit samples each
+ *  @param  colorCount  number of palette colors, from 1 to 256
+ *
+ *  @throws vips::VError if file can't be written
+ */
+void SaveIndexedPng(const uint8_t* indices, uint32_t width, uint32_t height, const uint8_t* colors,
+    uint32_t colorCount, uint32_t bands, const std::string& path, const EncoderOptions& options);
+
+/** @brief  Saves image that did not change, without decoding and encoding when possible
+ *
+ *  File at @p in is copied as is if it is already in the requested format
+ *
+ *  @param  img     image loaded from @p in
+ *
+ *  @throws vips::VError if image can't be copied or saved
+ */
+void SaveUnchanged(const vips::VImage& img, const std::string& in, const std::string& out,
+    const EncoderOptions& options);
+
+#endif // ANINISCALE_ENCODER_HPP
@@ -0,0 +1,49 @@
+/*
+* Copyright (c) 2017 Dmitry Odintsov
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#ifndef ANINISCALE_HASH_HPP
+#define ANINISCALE_HASH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/** @brief  Fast non-cryptographic 64-bit hash of a byte range
+ *
+ *  Consumes 8 bytes per step. Hashes of consecutive chunks can be chained
+ *  by passing previous hash as @p seed, result then depends on how data was
+ *  split into chunks. Byte order of the host is not normalized.
+ */
+inline uint64_t HashBytes(const void* data, size_t size, uint64_t seed = 0)
+{
+    static const uint64_t multiplier = 0x9E3779B97F4A7C15ull;
+    static const uint64_t finalizer = 0xC4CEB9FE1A85EC53ull;
+
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    uint64_t hash = seed ^ (size * multiplier);
+    uint64_t word;
+
+    for (; size >= sizeof(word); size -= sizeof(word), bytes += sizeof(word))
+    {
+        memcpy(&word, bytes, sizeof(word));
+
+        hash ^= word * multiplier;
+        hash = ((hash << 29) | (hash >> 35)) * finalizer;
+    }
+
+    word = 0;
+    memcpy(&word, bytes, size);
+    hash ^= word * multiplier;
+
+    //! Spreads every input bit over the whole result
+    hash ^= hash >> 33;
+    hash *= finalizer;
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+#endif // ANINISCALE_HASH_HPP
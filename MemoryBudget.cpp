@@ -0,0 +1,172 @@
+/*
+* Copyright (c) 2017 Dmitry Odintsov
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "MemoryBudget.hpp"
+
+#include <vips/vips8>
+
+#include <algorithm>
+#include <sstream>
+
+MemoryBudget::MemoryBudget(uint64_t limit)
+    : m_limit(limit)
+    , m_used(0)
+    , m_peak(0)
+{
+
+}
+
+uint64_t MemoryBudget::Limit() const
+{
+    return m_limit;
+}
+
+uint64_t MemoryBudget::Peak() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_peak;
+}
+
+void MemoryBudget::Acquire(uint64_t bytes)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    MakeRoom(lock, bytes);
+
+    m_used += bytes;
+    m_peak = std::max(m_peak, m_used);
+}
+
+void MemoryBudget::Release(uint64_t bytes)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_used -= bytes;
+    m_returned.notify_all();
+}
+
+std::unique_ptr<uint8_t[]> MemoryBudget::Borrow(size_t size, size_t& capacity)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    //! Smallest idle buffer big enough, it is already accounted for
+    std::vector<IdleBuffer>::iterator best = m_idle.end();
+
+    for (std::vector<IdleBuffer>::iterator it = m_idle.begin(); it != m_idle.end(); ++it)
+    {
+        if (it->size >= size && (best == m_idle.end() || it->size < best->size))
+        {
+            best = it;
+        }
+    }
+
+    if (best != m_idle.end())
+    {
+        std::unique_ptr<uint8_t[]> data = std::move(best->data);
+        capacity = best->size;
+        m_idle.erase(best);
+
+        return data;
+    }
+
+    MakeRoom(lock, size);
+
+    m_used += size;
+    m_peak = std::max(m_peak, m_used);
+    capacity = size;
+
+    //! Memory is accounted already, so nobody else takes it while it is allocated
+    lock.unlock();
+
+    return std::unique_ptr<uint8_t[]>(new uint8_t[size]);
+}
+
+void MemoryBudget::Return(std::unique_ptr<uint8_t[]> data, size_t capacity)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    IdleBuffer buffer;
+    buffer.data = std::move(data);
+    buffer.size = capacity;
+    m_idle.push_back(std::move(buffer));
+
+    m_returned.notify_all();
+}
+
+void MemoryBudget::MakeRoom(std::unique_lock<std::mutex>& lock, uint64_t bytes)
+{
+    if (bytes > m_limit)
+    {
+        std::ostringstream message;
+        message << bytes << " bytes don't fit into memory limit of " << m_limit << " bytes";
+
+        throw vips::VError(message.str());
+    }
+
+    while (m_used + bytes > m_limit)
+    {
+        if (m_idle.empty())
+        {
+            m_returned.wait(lock);
+            continue;
+        }
+
+        //! Largest idle buffer goes first, so as few as possible are lost
+        std::vector<IdleBuffer>::iterator largest = std::max_element(m_idle.begin(), m_idle.end(),
+            [](const IdleBuffer& a, const IdleBuffer& b){
+                return a.size < b.size;
+            });
+
+        m_used -= largest->size;
+        m_idle.erase(largest);
+    }
+}
+
+BudgetReservation::BudgetReservation()
+    : m_budget(0)
+    , m_bytes(0)
+{
+
+}
+
+BudgetReservation::BudgetReservation(MemoryBudget* budget, uint64_t bytes)
+    : m_budget(0)
+    , m_bytes(0)
+{
+    Reset(budget, bytes);
+}
+
+BudgetReservation::~BudgetReservation()
+{
+    Reset(0, 0);
+}
+
+void BudgetReservation::Reset(MemoryBudget* budget, uint64_t bytes)
+{
+    if (m_budget)
+    {
+        m_budget->Release(m_bytes);
+        m_budget = 0;
+        m_bytes = 0;
+    }
+
+    if (budget)
+    {
+        budget->Acquire(bytes);
+        m_budget = budget;
+        m_bytes = bytes;
+    }
+}
+
+PooledBuffer::PooledBuffer(MemoryBudget& budget, size_t size)
+    : m_budget(budget)
+    , m_capacity(0)
+{
+    m_data = budget.Borrow(size, m_capacity);
+}
+
+PooledBuffer::~PooledBuffer()
+{
+    m_budget.Return(std::move(m_data), m_capacity);
+}
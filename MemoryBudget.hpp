@@ -0,0 +1,150 @@
+/*
+* Copyright (c) 2017 Dmitry Odintsov
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#ifndef ANINISCALE_MEMORY_BUDGET_HPP
+#define ANINISCALE_MEMORY_BUDGET_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/** @brief  Limits memory held by images and task buffers at once
+ *
+ *  Whoever needs memory waits until enough of it is returned, so work is
+ *  admitted only as fast as the budget allows. Task buffers returned are
+ *  kept for reuse and still count as used, they are freed only when
+ *  someone needs the room for something else.
+ */
+class MemoryBudget
+{
+public:
+    /** @brief  Constructor
+     *
+     *  @param  limit   maximum number of bytes in use at once
+     */
+    explicit MemoryBudget(uint64_t limit);
+
+    //! Returns maximum number of bytes in use at once
+    uint64_t Limit() const;
+
+    //! Returns highest number of bytes ever in use at once, idle buffers included
+    uint64_t Peak() const;
+
+    /** @brief  Accounts memory allocated elsewhere, waits until it fits
+     *
+     *  @throws vips::VError if @p bytes exceed the limit
+     */
+    void Acquire(uint64_t bytes);
+
+    //! Gives memory accounted by Acquire() back
+    void Release(uint64_t bytes);
+
+private:
+    friend class PooledBuffer;
+
+    //! Buffer kept for reuse
+    struct IdleBuffer
+    {
+        std::unique_ptr<uint8_t[]> data;
+        size_t size;
+    };
+
+    /** @brief  Takes an idle buffer of at least @p size bytes, or allocates a new one, waits until it fits
+     *
+     *  @param[out] capacity    size of the buffer returned
+     *
+     *  @throws vips::VError if @p size exceeds the limit
+     */
+    std::unique_ptr<uint8_t[]> Borrow(size_t size, size_t& capacity);
+
+    //! Keeps borrowed buffer for reuse
+    void Return(std::unique_ptr<uint8_t[]> data, size_t capacity);
+
+    /** @brief  Frees idle buffers until @p bytes more fit, waits for memory in use to be returned if they don't
+     *
+     *  @throws vips::VError if @p bytes exceed the limit
+     */
+    void MakeRoom(std::unique_lock<std::mutex>& lock, uint64_t bytes);
+
+    const uint64_t m_limit;
+
+    //! Mutex protecting state below
+    mutable std::mutex m_mutex;
+
+    //! Wakes waiters up when memory is given back
+    std::condition_variable m_returned;
+
+    //! Bytes in use, idle buffers included
+    uint64_t m_used;
+    uint64_t m_peak;
+
+    std::vector<IdleBuffer> m_idle;
+};
+
+//! Memory accounted in a budget for the lifetime of the object
+class BudgetReservation
+{
+public:
+    //! Constructor, nothing is reserved
+    BudgetReservation();
+
+    /** @brief  Constructor, waits until @p bytes fit
+     *
+     *  @param  budget  budget to account memory in, null if memory is not limited
+     *
+     *  @throws vips::VError if @p bytes exceed the limit
+     */
+    BudgetReservation(MemoryBudget* budget, uint64_t bytes);
+
+    //! Destructor, gives memory back
+    ~BudgetReservation();
+
+    BudgetReservation(const BudgetReservation&) = delete;
+    BudgetReservation& operator=(const BudgetReservation&) = delete;
+
+    /** @brief  Gives memory reserved so far back and reserves @p bytes instead
+     *
+     *  @throws vips::VError if @p bytes exceed the limit
+     */
+    void Reset(MemoryBudget* budget, uint64_t bytes);
+
+private:
+    MemoryBudget* m_budget;
+    uint64_t m_bytes;
+};
+
+//! Buffer borrowed from a budget for the lifetime of the object
+class PooledBuffer
+{
+public:
+    /** @brief  Constructor, waits until a buffer of @p size bytes fits
+     *
+     *  Contents are left from the previous borrower.
+     *
+     *  @throws vips::VError if @p size exceeds the limit
+     */
+    PooledBuffer(MemoryBudget& budget, size_t size);
+
+    //! Destructor, returns the buffer
+    ~PooledBuffer();
+
+    PooledBuffer(const PooledBuffer&) = delete;
+    PooledBuffer& operator=(const PooledBuffer&) = delete;
+
+    uint8_t* Data() const
+    {
+        return m_data.get();
+    }
+
+private:
+    MemoryBudget& m_budget;
+    std::unique_ptr<uint8_t[]> m_data;
+    size_t m_capacity;
+};
+
+#endif // ANINISCALE_MEMORY_BUDGET_HPP
@@ -0,0 +1,281 @@
+/*
+* Copyright (c) 2017 Dmitry Odintsov
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "Palette.hpp"
+
+#include "Profiler.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+//! Every worker indexes a few bands, so stealing can even out their speeds
+static const uint32_t s_bandsPerWorker = 4;
+
+namespace
+{
+
+//! Packs pixel of up to 4 bytes into a color
+inline uint32_t PackColor(const uint8_t* pixel, uint32_t pixelBytes)
+{
+    uint32_t color = 0;
+    memcpy(&color, pixel, pixelBytes);
+
+    return color;
+}
+
+/** @brief  Maps colors to their palette indices
+ *
+ *  Open-addressed table with room for twice as many colors as a palette
+ *  holds, so lookups rarely probe more than one slot
+ */
+class ColorTable
+{
+public:
+    ColorTable()
+        : m_used(0)
+    {
+        std::fill(m_slots, m_slots + s_slotCount, Slot{ 0, -1 });
+    }
+
+    //! Returns number of colors added
+    uint32_t Size() const
+    {
+        return m_used;
+    }
+
+    //! Returns color with given index
+    uint32_t Color(uint32_t index) const
+    {
+        return m_colors[index];
+    }
+
+    /** @brief  Looks color up, adding it with the next index if it is new
+     *
+     *  @return index of @p color, s_maxPaletteColors if palette is full
+     */
+    uint32_t Index(uint32_t color)
+    {
+        uint32_t slot = (color * 2654435769u) >> (32 - s_slotBits);
+
+        while (m_slots[slot].index >= 0)
+        {
+            if (m_slots[slot].color == color)
+            {
+                return m_slots[slot].index;
+            }
+
+            slot = (slot + 1) & (s_slotCount - 1);
+        }
+
+        if (m_used == s_maxPaletteColors)
+        {
+            return s_maxPaletteColors;
+        }
+
+        m_slots[slot].color = color;
+        m_slots[slot].index = m_used;
+        m_colors[m_used] = color;
+
+        return m_used++;
+    }
+
+private:
+    static const uint32_t s_slotBits = 9;
+    static const uint32_t s_slotCount = 1 << s_slotBits;
+
+    struct Slot
+    {
+        uint32_t color;
+        int32_t index;
+    };
+
+    Slot m_slots[s_slotCount];
+
+    //! Colors by index
+    uint32_t m_colors[s_maxPaletteColors];
+    uint32_t m_used;
+};
+
+/** @brief  Indexes rows of an image with colors of their own, in order of first appearance
+ *
+ *  @param[out] colors  colors met, by index
+ *  @param[out] out     first index of the rows, rows are packed without padding
+ *
+ *  @return false if rows have more than s_maxPaletteColors colors
+ */
+bool IndexRows(const uint8_t* pixels, size_t stride, uint32_t width, uint32_t height, uint32_t pixelBytes,
+    std::vector<uint32_t>& colors, uint8_t* out)
+{
+    ColorTable table;
+
+    for (uint32_t y = 0; y < height; ++y)
+    {
+        const uint8_t* row = pixels + y * stride;
+        uint8_t* outRow = out + static_cast<size_t>(y) * width;
+
+        uint32_t last = 0;
+        uint32_t lastIndex = s_maxPaletteColors;
+
+        for (uint32_t x = 0; x < width; ++x)
+        {
+            const uint32_t color = PackColor(row + x * pixelBytes, pixelBytes);
+
+            //! Neighbouring pixels tend to match, skip the lookup for those
+            if (color != last || lastIndex == s_maxPaletteColors)
+            {
+                last = color;
+                lastIndex = table.Index(color);
+
+                if (lastIndex == s_maxPaletteColors)
+                {
+                    return false;
+                }
+            }
+
+            outRow[x] = lastIndex;
+        }
+    }
+
+    colors.resize(table.Size());
+
+    for (uint32_t i = 0; i < colors.size(); ++i)
+    {
+        colors[i] = table.Color(i);
+    }
+
+    return true;
+}
+
+//! Fills palette with colors packed by PackColor()
+void FillPalette(const std::vector<uint32_t>& colors, uint32_t pixelBytes, Palette& palette)
+{
+    palette.pixelBytes = pixelBytes;
+    palette.colors.resize(colors.size() * pixelBytes);
+
+    for (uint32_t i = 0; i < colors.size(); ++i)
+    {
+        memcpy(&palette.colors[i * pixelBytes], &colors[i], pixelBytes);
+    }
+}
+
+} // namespace
+
+bool CanIndex(const BlockShape& shape)
+{
+    return shape.sampleBytes == 1 && shape.bands >= 1 && shape.bands <= 4;
+}
+
+BlockShape IndexShape(const BlockShape& shape)
+{
+    BlockShape indexShape = shape;
+    indexShape.bands = 1;
+    indexShape.sampleBytes = 1;
+
+    return indexShape;
+}
+
+bool IndexImage(WorkerPool& pool, const uint8_t* pixels, size_t stride, uint32_t width, uint32_t height,
+    uint32_t pixelBytes, Palette& palette, std::vector<uint8_t>& indices)
+{
+    ProfileSpan span("index");
+
+    const uint32_t bandCount = std::max(1u, std::min(height, pool.WorkerCount() * s_bandsPerWorker));
+    const uint32_t bandRows = (height + bandCount - 1) / bandCount;
+
+    indices.resize(static_cast<size_t>(width) * height);
+
+    std::vector<std::vector<uint32_t>> bandColors(bandCount);
+    std::atomic<bool> overflow(false);
+
+    pool.Run(bandCount, [&](WorkerPool&, uint32_t band){
+        const uint32_t first = std::min(height, band * bandRows);
+        const uint32_t rows = std::min(height, first + bandRows) - first;
+
+        if (!overflow && !IndexRows(pixels + first * stride, stride, width, rows, pixelBytes, bandColors[band],
+            indices.data() + static_cast<size_t>(first) * width))
+        {
+            overflow = true;
+        }
+    });
+
+    if (overflow)
+    {
+        return false;
+    }
+
+    //! Bands are merged in order, so colors keep the order of their first appearance in the whole image
+    ColorTable table;
+    std::vector<std::vector<uint8_t>> translations(bandCount);
+    std::vector<uint32_t> colors;
+
+    for (uint32_t band = 0; band < bandCount; ++band)
+    {
+        bool identity = true;
+
+        for (uint32_t i = 0; i < bandColors[band].size(); ++i)
+        {
+            const uint32_t index = table.Index(bandColors[band][i]);
+
+            if (index == s_maxPaletteColors)
+            {
+                return false;
+            }
+
+            if (index == colors.size())
+            {
+                colors.push_back(bandColors[band][i]);
+            }
+
+            translations[band].push_back(index);
+            identity = identity && index == i;
+        }
+
+        //! Bands that met their colors in palette order need no translation
+        if (identity)
+        {
+            translations[band].clear();
+        }
+    }
+
+    pool.Run(bandCount, [&](WorkerPool&, uint32_t band){
+        const std::vector<uint8_t>& translation = translations[band];
+
+        if (translation.empty())
+        {
+            return;
+        }
+
+        const uint32_t first = std::min(height, band * bandRows);
+        const uint32_t rows = std::min(height, first + bandRows) - first;
+        uint8_t* index = indices.data() + static_cast<size_t>(first) * width;
+
+        for (size_t i = 0; i < static_cast<size_t>(rows) * width; ++i)
+        {
+            index[i] = translation[index[i]];
+        }
+    });
+
+    FillPalette(colors, pixelBytes, palette);
+
+    return true;
+}
+
+bool IndexArea(const uint8_t* pixels, size_t stride, uint32_t width, uint32_t height,
+    uint32_t pixelBytes, Palette& palette, std::vector<uint8_t>& indices)
+{
+    indices.resize(static_cast<size_t>(width) * height);
+    std::vector<uint32_t> colors;
+
+    if (!IndexRows(pixels, stride, width, height, pixelBytes, colors, indices.data()))
+    {
+        return false;
+    }
+
+    FillPalette(colors, pixelBytes, palette);
+
+    return true;
+}
@@ -0,0 +1,64 @@
+/*
+* Copyright (c) 2017 Dmitry Odintsov
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#ifndef ANINISCALE_PALETTE_HPP
+#define ANINISCALE_PALETTE_HPP
+
+#include "DominantColor.hpp"
+#include "WorkerPool.hpp"
+
+#include <cstdint>
+#include <vector>
+
+//! Largest number of colors an indexed image can have
+static const uint32_t s_maxPaletteColors = 256;
+
+//! Colors of an indexed image, in order of their first appearance
+struct Palette
+{
+    //! Size of a single color in bytes, same as of an image pixel
+    uint32_t pixelBytes;
+
+    //! Colors one after another, as image pixels store them
+    std::vector<uint8_t> colors;
+
+    uint32_t Size() const
+    {
+        return colors.size() / pixelBytes;
+    }
+};
+
+//! Checks whether images of @p shape can be indexed: 8-bit samples, 1 to 4 bands
+bool CanIndex(const BlockShape& shape);
+
+//! Returns shape of blocks of index image made of an image with blocks of @p shape
+BlockShape IndexShape(const BlockShape& shape);
+
+/** @brief  Maps every pixel to index of its color in a palette built on the way
+ *
+ *  Image is split into bands of rows, every band collects and indexes its
+ *  own colors, then band palettes are merged in order and indices of every
+ *  band but the first are translated. The palette is the same whatever the
+ *  number of workers.
+ *
+ *  @attention  shall not be called from a task running on @p pool
+ *
+ *  @param[in]  pixels      top left pixel of the image
+ *  @param[in]  stride      distance between image rows in bytes
+ *  @param[in]  pixelBytes  size of a pixel, image shall pass CanIndex()
+ *  @param[out] palette     image colors
+ *  @param[out] indices     one byte per pixel, rows are packed without padding
+ *
+ *  @return false if image has more than s_maxPaletteColors colors
+ */
+bool IndexImage(WorkerPool& pool, const uint8_t* pixels, size_t stride, uint32_t width, uint32_t height,
+    uint32_t pixelBytes, Palette& palette, std::vector<uint8_t>& indices);
+
+//! IndexImage() on the calling thread, may be called from a task
+bool IndexArea(const uint8_t* pixels, size_t stride, uint32_t width, uint32_t height,
+    uint32_t pixelBytes, Palette& palette, std::vector<uint8_t>& indices);
+
+#endif // ANINISCALE_PALETTE_HPP
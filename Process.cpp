@@ -0,0 +1,1508 @@
+/*
+* Copyright (c) 2017 Dmitry Odintsov
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "Process.hpp"
+
+#include <vips/vips8>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "BlockHashes.hpp"
+#include "BoundedQueue.hpp"
+#include "DominantColor.hpp"
+#include "Encoder.hpp"
+#include "Hash.hpp"
+#include "MemoryBudget.hpp"
+#include "Palette.hpp"
+#include "Profiler.hpp"
+#include "ProgressiveImage.hpp"
+#include "Reporter.hpp"
+#include "TaskGeometry.hpp"
+
+//! Approximate size of input strip loaded at once in stream and pipeline modes
+static const size_t s_streamStripBytes = 32 << 20;
+
+//! Number of decoded strips allowed to wait for processing in pipeline mode
+static const size_t s_pipelineDepth = 2;
+
+namespace
+{
+
+/** @brief  Saves input image as is, used when blocks are 1x1
+ *
+ *  @return 0 on success, error is printed otherwise
+ */
+int SaveInput(const vips::VImage& img, const Arguments& arguments)
+{
+    try
+    {
+        SaveUnchanged(img, arguments.in, arguments.out, arguments.Encoding());
+    }
+    catch( vips::VError& e )
+    {
+        std::cout << "Error occured while saving resulting image to " << arguments.out.c_str() << std::endl;
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+//! How an image is split into strips of block rows, and strips into tasks
+struct StripPlan
+{
+    //! Number of block rows in a strip
+    uint32_t stripTiles;
+    uint32_t stripCount;
+
+    //! Every strip is split into tasks of this geometry
+    TaskGeometry tasks;
+};
+
+//! Rows of input image loaded for processing
+struct Strip
+{
+    vips::VImage area;
+    const uint8_t* pixels;
+
+    //! First block row and number of block rows in the strip
+    uint32_t y_first;
+    uint32_t y_count;
+};
+
+/** @brief  Opens input image for reading top to bottom
+ *
+ *  Only the rows in use are kept in memory
+ *
+ *  @return false if image can't be opened
+ */
+bool OpenSequential(const Arguments& arguments, vips::VImage& img)
+{
+    try
+    {
+        img = vips::VImage::new_from_file( arguments.in.c_str(),
+            vips::VImage::option()->set("access", VIPS_ACCESS_SEQUENTIAL) );
+        WarnFirstFrame(img, arguments.in);
+    }
+    catch( vips::VError& e )
+    {
+        std::cout << "Error occured while opening image " << arguments.in.c_str() << std::endl;
+        std::cerr << e.what() << std::endl;
+        return false;
+    }
+
+    if (img.width() < arguments.x_blockSize || img.height() < arguments.y_blockSize)
+    {
+        std::cout << "Image " << arguments.in.c_str() << " is smaller than a single block" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+//! Returns geometry of blocks @p img is split into
+BlockShape ShapeOf(const vips::VImage& img, const Arguments& arguments)
+{
+    BlockShape shape;
+    shape.bands = img.bands();
+    shape.sampleBytes = vips_format_sizeof(img.format());
+    shape.x = arguments.x_blockSize;
+    shape.y = arguments.y_blockSize;
+
+    return shape;
+}
+
+//! Returns size of @p img loaded to memory, in bytes
+uint64_t DecodedBytes(const vips::VImage& img)
+{
+    return static_cast<uint64_t>(img.width()) * img.height() * img.bands() * vips_format_sizeof(img.format());
+}
+
+/** @brief  Opens every frame of animated and multi-page images, other images as they are
+ *
+ *  Frames are stacked one under another, FrameHeight() tells them apart
+ *
+ *  @throws vips::VError if image can't be opened
+ */
+vips::VImage OpenFrames(const std::string& path)
+{
+    vips::VImage img = vips::VImage::new_from_file( path.c_str() );
+
+    //! Only loaders of multi-page formats report page count, and all of them take n
+    if (vips_image_get_n_pages(img.get_image()) > 1)
+    {
+        img = vips::VImage::new_from_file( path.c_str(), vips::VImage::option()->set("n", -1) );
+    }
+
+    return img;
+}
+
+//! Returns height of a single frame of @p img, whole height if it has just one
+uint32_t FrameHeight(const vips::VImage& img)
+{
+    return vips_image_get_page_height(img.get_image());
+}
+
+/** @brief  Returns memory ProcessWhole() holds for @p img: decoded pixels, output and palette indices if any
+ *
+ *  Everything is reserved at once, a worker waiting for more while holding a part could wait forever.
+ */
+uint64_t WholeBytes(const vips::VImage& img, const BlockShape& shape, bool palette)
+{
+    const uint32_t frameHeight = FrameHeight(img);
+    const uint64_t outBytes = static_cast<uint64_t>(img.width() / shape.x) * (frameHeight / shape.y) *
+        (img.height() / frameHeight) * shape.bands * shape.sampleBytes;
+    const uint64_t indexBytes = palette && CanIndex(shape) ? static_cast<uint64_t>(img.width()) * img.height() : 0;
+
+    return DecodedBytes(img) + outBytes + indexBytes;
+}
+
+//! Gives @p out, downscaled from @p in frame by frame, frame layout and timing of @p in
+void CopyFrames(const vips::VImage& in, const vips::VImage& out)
+{
+    const uint32_t frames = in.height() / FrameHeight(in);
+
+    if (frames <= 1)
+    {
+        return;
+    }
+
+    vips_image_set_int(out.get_image(), "page-height", out.height() / frames);
+
+    int* delay = 0;
+    int count = 0;
+
+    if (in.get_typeof("delay") && 0 == vips_image_get_array_int(in.get_image(), "delay", &delay, &count))
+    {
+        vips_image_set_array_int(out.get_image(), "delay", delay, count);
+    }
+
+    if (in.get_typeof("loop"))
+    {
+        vips_image_set_int(out.get_image(), "loop", in.get_int("loop"));
+    }
+}
+
+StripPlan PlanStrips(const Arguments& arguments, const vips::VImage& img, const WorkerPool& pool)
+{
+    const uint32_t x_tiles = img.width() / arguments.x_blockSize;
+    const uint32_t y_tiles = img.height() / arguments.y_blockSize;
+
+    StripPlan plan;
+
+    //! Strip is a whole number of block rows, small enough to keep a few of them in memory
+    const size_t blockRowBytes = static_cast<size_t>(img.width()) * img.bands() *
+        vips_format_sizeof(img.format()) * arguments.y_blockSize;
+
+    //! Strips waiting, processed and decoded at once in pipeline mode fit into the memory limit together
+    const uint64_t stripBytes = pool.Memory() ?
+        std::min<uint64_t>(s_streamStripBytes, pool.Memory()->Limit() / (s_pipelineDepth + 2)) : s_streamStripBytes;
+
+    plan.stripTiles = std::max<uint64_t>(1, stripBytes / blockRowBytes);
+
+    if (arguments.taskBlockSide > 0)
+    {
+        plan.stripTiles = std::min<uint32_t>(plan.stripTiles, arguments.taskBlockSide);
+    }
+
+    plan.stripTiles = std::min(plan.stripTiles, y_tiles);
+    plan.stripCount = (y_tiles + plan.stripTiles - 1) / plan.stripTiles;
+
+    //! Every strip is split between workers on its own
+    plan.tasks = PlanTasks(ShapeOf(img, arguments), x_tiles, plan.stripTiles, pool.WorkerCount(),
+        arguments.taskBlockSide);
+
+    return plan;
+}
+
+/** @brief  Loads a strip of block rows
+ *
+ *  @throws vips::VError if rows can't be read
+ */
+Strip LoadStrip(const vips::VImage& img, const Arguments& arguments, const StripPlan& plan, uint32_t strip)
+{
+    const uint32_t y_tiles = img.height() / arguments.y_blockSize;
+
+    Strip result;
+    result.y_first = strip * plan.stripTiles;
+    result.y_count = std::min(plan.stripTiles, y_tiles - result.y_first);
+
+    //! libvips reads only as much of the file as needed
+    result.area = img.extract_area(0, result.y_first * arguments.y_blockSize,
+        img.width(), result.y_count * arguments.y_blockSize);
+    ProfileSpan span("materialize");
+    result.pixels = reinterpret_cast<const uint8_t*>(result.area.data());
+
+    if (!result.pixels)
+    {
+        throw vips::VError();
+    }
+
+    return result;
+}
+
+/** @brief  Processes a strip on all workers
+ *
+ *  @param  out         first pixel of output row matching first block row of the strip
+ *  @param  outStride   distance between output rows in bytes
+ */
+void ProcessStrip(WorkerPool& pool, DominantColorKernel kernel, const BlockShape& shape,
+    const StripPlan& plan, const Strip& strip, uint8_t* out, size_t outStride)
+{
+    const uint32_t width = strip.area.width();
+
+    ProcessTasks(pool, kernel, shape, strip.pixels, static_cast<size_t>(width) * shape.bands * shape.sampleBytes,
+        width / shape.x, strip.y_count, out, outStride, plan.tasks);
+}
+
+/** @brief  Collects batch input paths
+ *
+ *  @param[in]  path    directory with images or a text file listing one image path per line
+ *  @param[out] inputs  paths of images to process
+ *
+ *  @return false if @p path can't be read
+ */
+bool ListBatchInputs(const std::string& path, std::vector<std::string>& inputs)
+{
+    struct stat info;
+
+    if (0 != stat(path.c_str(), &info))
+    {
+        return false;
+    }
+
+    if (S_ISDIR(info.st_mode))
+    {
+        DIR* dir = opendir(path.c_str());
+
+        if (!dir)
+        {
+            return false;
+        }
+
+        while (dirent* entry = readdir(dir))
+        {
+            const std::string file = path + "/" + entry->d_name;
+
+            //! Skip hidden files and anything libvips can't load
+            if (entry->d_name[0] != '.' && 0 == stat(file.c_str(), &info) && S_ISREG(info.st_mode) &&
+                vips_foreign_find_load(file.c_str()))
+            {
+                inputs.push_back(file);
+            }
+        }
+
+        closedir(dir);
+
+        //! Keep the order stable regardless of file system
+        std::sort(inputs.begin(), inputs.end());
+
+        return true;
+    }
+
+    std::ifstream list(path.c_str());
+
+    if (!list)
+    {
+        return false;
+    }
+
+    std::string line;
+
+    while (std::getline(list, line))
+    {
+        //! Ignore blank lines, comments and Windows line endings
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+
+        if (!line.empty() && line[0] != '#')
+        {
+            inputs.push_back(line);
+        }
+    }
+
+    return true;
+}
+
+/** @brief  Downscales whole image on the calling worker
+ *
+ *  Used for images too small to be worth splitting between workers
+ *
+ *  @throws vips::VError if image can't be loaded or saved
+ */
+void ProcessWhole(WorkerPool& worker, const Arguments& arguments)
+{
+    vips::VImage img = OpenFrames(arguments.in);
+
+    //! If both blocks are 1, we can just save the image
+    if (arguments.x_blockSize == 1 && arguments.y_blockSize == 1)
+    {
+        SaveUnchanged(img, arguments.in, arguments.out, arguments.Encoding());
+        return;
+    }
+
+    const BlockShape shape = ShapeOf(img, arguments);
+    const uint32_t pixelBytes = shape.bands * shape.sampleBytes;
+
+    //! Frames are processed one after another, blocks never span two of them
+    const uint32_t frameHeight = FrameHeight(img);
+    const uint32_t frames = img.height() / frameHeight;
+
+    const uint32_t x_tiles = img.width() / shape.x;
+    const uint32_t y_tiles = frameHeight / shape.y;
+
+    if (0 == x_tiles || 0 == y_tiles)
+    {
+        throw vips::VError("image is smaller than a single block");
+    }
+
+    //! Waits while other images use the memory up
+    BudgetReservation reservation(worker.Memory(), WholeBytes(img, shape, arguments.palette));
+
+    std::vector<uint8_t> outBuffer(x_tiles * y_tiles * frames * pixelBytes);
+    const uint8_t* pixels = reinterpret_cast<const uint8_t*>(img.data());
+
+    if (!pixels)
+    {
+        throw vips::VError();
+    }
+
+    //! Images of few colors are processed and saved as palette indices
+    if (arguments.palette && CanIndex(shape))
+    {
+        Palette palette;
+        std::vector<uint8_t> indices;
+
+        if (IndexArea(pixels, img.width() * pixelBytes, img.width(), img.height(), pixelBytes, palette, indices))
+        {
+            for (uint32_t frame = 0; frame < frames; ++frame)
+            {
+                worker.ProcessArea(DominantColorIndexed, IndexShape(shape),
+                    indices.data() + static_cast<size_t>(frame) * frameHeight * img.width(), img.width(),
+                    img.width(), frameHeight, outBuffer.data() + frame * y_tiles * x_tiles, x_tiles);
+            }
+
+            SaveIndexedPng(outBuffer.data(), x_tiles, y_tiles * frames, palette.colors.data(), palette.Size(),
+                shape.bands, arguments.out, arguments.Encoding());
+            return;
+        }
+    }
+
+    const DominantColorKernel kernel = SelectDominantColorKernel(shape);
+    const size_t stride = static_cast<size_t>(img.width()) * pixelBytes;
+
+    for (uint32_t frame = 0; frame < frames; ++frame)
+    {
+        worker.ProcessArea(kernel, shape, pixels + static_cast<size_t>(frame) * frameHeight * stride, stride,
+            img.width(), frameHeight, outBuffer.data() + frame * y_tiles * x_tiles * pixelBytes, x_tiles * pixelBytes);
+    }
+
+    vips::VImage outImg = vips::VImage::new_from_memory(outBuffer.data(), outBuffer.size(),
+        x_tiles, y_tiles * frames, shape.bands, img.format());
+
+    CopyFrames(img, outImg);
+    SaveImage(outImg, arguments.out, arguments.Encoding());
+}
+
+/** @brief  Downscales image of few colors through palette indices and saves it as indexed PNG
+ *
+ *  Votes count indices in a small array instead of looking colors up, and
+ *  output is written as indices with the palette, never turned back into colors.
+ *
+ *  @return false if image has more than s_maxPaletteColors colors, nothing is saved then
+ *
+ *  @throws vips::VError if output can't be saved
+ */
+bool ProcessIndexed(WorkerPool& pool, const Arguments& arguments, const vips::VImage& img, const BlockShape& shape,
+    const uint8_t* pixels)
+{
+    const uint32_t width = img.width();
+    const uint32_t height = img.height();
+    const size_t stride = static_cast<size_t>(width) * shape.bands * shape.sampleBytes;
+
+    //! All frames share the palette
+    const uint32_t frameHeight = FrameHeight(img);
+    const uint32_t frames = height / frameHeight;
+
+    BudgetReservation reservation(pool.Memory(), static_cast<uint64_t>(width) * height);
+
+    Palette palette;
+    std::vector<uint8_t> indices;
+
+    if (!IndexImage(pool, pixels, stride, width, height, shape.bands * shape.sampleBytes, palette, indices))
+    {
+        return false;
+    }
+
+    const BlockShape indexShape = IndexShape(shape);
+    const uint32_t x_tiles = width / shape.x;
+    const uint32_t y_tiles = frameHeight / shape.y;
+
+    std::cout << "Image has " << palette.Size() << " colors, processing palette indices" << std::endl;
+
+    std::vector<uint8_t> outIndices(static_cast<size_t>(x_tiles) * y_tiles * frames);
+
+    {
+        Reporter reporter(pool.Stats(), pool.WorkerCount(), static_cast<uint64_t>(x_tiles) * y_tiles * frames,
+            shape.x * shape.y);
+
+        ProcessTasks(pool, DominantColorIndexed, indexShape, indices.data(), width, x_tiles, y_tiles,
+            outIndices.data(), x_tiles,
+            PlanTasks(indexShape, x_tiles, y_tiles, pool.WorkerCount(), arguments.taskBlockSide, frames),
+            frames, static_cast<size_t>(frameHeight) * width, static_cast<size_t>(y_tiles) * x_tiles);
+    }
+
+    std::cout << "Saving resulting image" << std::endl;
+
+    //! PNG has no frames, they stay stacked one under another
+    SaveIndexedPng(outIndices.data(), x_tiles, y_tiles * frames, palette.colors.data(), palette.Size(), shape.bands,
+        arguments.out, arguments.Encoding());
+
+    return true;
+}
+
+//! Returns path of block hashes kept next to the output in incremental mode
+std::string BlockHashesPath(const Arguments& arguments)
+{
+    return arguments.out + ".blocks";
+}
+
+//! Returns hash of output encoder settings
+uint64_t HashEncoding(const EncoderOptions& options)
+{
+    const int32_t settings[] = { options.format, options.compression, options.pngFilter, options.palette };
+
+    return HashBytes(settings, sizeof(settings));
+}
+
+/** @brief  Loads output of the previous incremental run, if it still matches its block hashes
+ *
+ *  @param  hashes      block hashes saved together with the output
+ *  @param  like        input image, output shall have its bands and sample format
+ *  @param  outBuffer   filled with output pixels
+ *
+ *  @return false if output is missing, was changed or has different shape
+ */
+bool LoadPreviousOutput(const Arguments& arguments, const BlockHashes& hashes, const vips::VImage& like,
+    std::vector<uint8_t>& outBuffer)
+{
+    try
+    {
+        vips::VImage previous = vips::VImage::new_from_file( arguments.out.c_str() );
+
+        if (static_cast<uint32_t>(previous.width()) != hashes.width / hashes.shape.x ||
+            static_cast<uint32_t>(previous.height()) != hashes.height / hashes.shape.y ||
+            previous.bands() != like.bands() || previous.format() != like.format())
+        {
+            return false;
+        }
+
+        const uint8_t* pixels = reinterpret_cast<const uint8_t*>(previous.data());
+
+        if (!pixels)
+        {
+            return false;
+        }
+
+        outBuffer.assign(pixels, pixels + outBuffer.size());
+    }
+    catch( vips::VError& )
+    {
+        return false;
+    }
+
+    return HashBytes(outBuffer.data(), outBuffer.size()) == hashes.output;
+}
+
+//! Returns output path of pyramid level: block size is appended to output file name, before extension
+std::string PyramidLevelPath(const std::string& out, const BlockSize& size)
+{
+    const size_t nameStart = out.find_last_of("/\\") + 1;
+    const size_t extension = out.find_last_of('.');
+    const size_t nameEnd = (extension == std::string::npos || extension < nameStart) ? out.size() : extension;
+
+    std::ostringstream path;
+    path << out.substr(0, nameEnd) << "_" << size.first << "x" << size.second << out.substr(nameEnd);
+
+    return path.str();
+}
+
+//! Returns counters of every worker of @p pool
+std::vector<WorkerSnapshot> SnapshotStats(const WorkerPool& pool)
+{
+    return SnapshotStats(pool.Stats(), pool.WorkerCount());
+}
+
+/** @brief  Prints blocks, throughput and utilization of every NUMA node since @p before
+ *
+ *  @param  seconds     wall time since @p before was taken
+ *  @param  blockPixels number of pixels in one block
+ */
+void ReportNodes(const WorkerPool& pool, const std::vector<WorkerSnapshot>& before, double seconds, uint32_t blockPixels)
+{
+    const std::vector<WorkerSnapshot> after = SnapshotStats(pool);
+
+    for (uint32_t node = 0; node < pool.NodeCount(); ++node)
+    {
+        uint32_t workers = 0;
+        uint64_t blocks = 0;
+        uint64_t busy = 0;
+
+        for (uint32_t i = 0; i < pool.WorkerCount(); ++i)
+        {
+            if (pool.WorkerNode(i) == node)
+            {
+                ++workers;
+                blocks += after[i].blocks - before[i].blocks;
+                busy += after[i].busy - before[i].busy;
+            }
+        }
+
+        const double megapixels = static_cast<double>(blocks) * blockPixels / 1e6;
+
+        std::cout << "Node " << pool.NodeId(node) << ": " << workers << " workers, " << megapixels << " Mpx, "
+            << (seconds > 0 ? megapixels / seconds : 0) << " Mpx/s, "
+            << (seconds > 0 && workers ? 100.0 * busy / 1e9 / seconds / workers : 0) << "% busy" << std::endl;
+    }
+}
+
+//! Downscales a single image in the mode requested by @p arguments, ignoring the cache
+int ProcessUncached(WorkerPool& pool, const Arguments& arguments)
+{
+    if (arguments.incremental)
+    {
+        return ProcessIncremental(pool, arguments);
+    }
+
+    if (arguments.pipeline)
+    {
+        return ProcessPipeline(pool, arguments);
+    }
+
+    return arguments.stream ? ProcessStream(pool, arguments) : Process(pool, arguments);
+}
+
+} // namespace
+
+int Process(WorkerPool& pool, const Arguments& arguments)
+{
+    //! Open the image, pixels are loaded once it is known how much memory they may take
+    vips::VImage img;
+
+    try
+    {
+        img = OpenFrames(arguments.in);
+
+        //! If both blocks are 1, we can just save the image
+        if (arguments.x_blockSize == 1 && arguments.y_blockSize == 1)
+        {
+            return SaveInput(img, arguments);
+        }
+    }
+    catch( vips::VError& e )
+    {
+        std::cout << "Error occured while opening image " << arguments.in.c_str() << std::endl;
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+
+    //! Samples of any type are processed in place, as raw bytes
+    const BlockShape shape = ShapeOf(img, arguments);
+    const uint32_t pixelBytes = shape.bands * shape.sampleBytes;
+
+    //! Get image information and estimate how it will be divided
+    const uint32_t width = img.width();
+    const uint32_t height = img.height();
+
+    //! Frames of animated and multi-page images are stacked, every one is split into blocks of its own
+    const uint32_t frameHeight = FrameHeight(img);
+    const uint32_t frames = height / frameHeight;
+
+    const uint32_t x_tiles = width / shape.x;
+    const uint32_t y_tiles = frameHeight / shape.y;
+
+    if (0 == x_tiles || 0 == y_tiles)
+    {
+        std::cout << "Image " << arguments.in.c_str() << " is smaller than a single block" << std::endl;
+        return -1;
+    }
+
+    const size_t stride = static_cast<size_t>(width) * pixelBytes;
+    const uint64_t totalPixels = static_cast<uint64_t>(width) * height;
+
+    const size_t outStride = static_cast<size_t>(x_tiles) * pixelBytes;
+    const size_t outFrameSize = outStride * y_tiles;
+    const size_t outSize = outFrameSize * frames;
+
+    //! Output stays in memory until it is encoded, input only if it fits next to the output
+    MemoryBudget* memory = pool.Memory();
+    BudgetReservation outReservation;
+    BudgetReservation inReservation;
+
+    //! Otherwise every task loads its own area, with NUMA placement on the node that processes it
+    const bool fits = !memory || outSize + stride * height <= memory->Limit();
+    const bool regions = arguments.numa || !fits;
+    const uint8_t* pixels = 0;
+
+    try
+    {
+        outReservation.Reset(memory, outSize);
+
+        if (!regions)
+        {
+            inReservation.Reset(memory, stride * height);
+
+            ProfileSpan span("decode");
+            pixels = reinterpret_cast<const uint8_t*>(img.data());
+
+            if (!pixels)
+            {
+                throw vips::VError();
+            }
+        }
+    }
+    catch( vips::VError& e )
+    {
+        std::cout << "Error occured while loading image " << arguments.in.c_str() << std::endl;
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+
+    //! Indices take a byte per pixel next to the input
+    if (arguments.palette)
+    {
+        if (pixels && CanIndex(shape) && (!memory || outSize + (stride + width) * height <= memory->Limit()))
+        {
+            try
+            {
+                if (ProcessIndexed(pool, arguments, img, shape, pixels))
+                {
+                    return 0;
+                }
+            }
+            catch( vips::VError& e )
+            {
+                std::cout << "Error occured while saving resulting image to " << arguments.out.c_str() << std::endl;
+                std::cerr << e.what() << std::endl;
+                return -1;
+            }
+
+            std::cout << "Image has more than " << s_maxPaletteColors << " colors, saving it without palette" << std::endl;
+        }
+        else
+        {
+            std::cout << "Image can't be indexed, saving it without palette" << std::endl;
+        }
+    }
+
+    //! Pick dominant color search routine best suited for this image and CPU
+    const DominantColorKernel kernel = SelectDominantColorKernel(shape);
+
+    //! Tasks are sized to the cache and worker count, edge tasks cover whatever blocks are left
+    TaskGeometry geometry = PlanTasks(shape, x_tiles, y_tiles, pool.WorkerCount(), arguments.taskBlockSide, frames);
+
+    //! Areas of tasks in progress share what the output leaves of the budget, every worker may hold one
+    if (regions && memory)
+    {
+        const uint64_t blockBytes = static_cast<uint64_t>(shape.x) * shape.y * pixelBytes;
+        const uint64_t taskBlocks = std::max<uint64_t>(1, (memory->Limit() - outSize) / pool.WorkerCount() / blockBytes);
+
+        if (static_cast<uint64_t>(geometry.x_blocks) * geometry.y_blocks > taskBlocks)
+        {
+            geometry = PlanTasks(shape, x_tiles, y_tiles, pool.WorkerCount(),
+                std::max<uint32_t>(1, static_cast<uint32_t>(std::sqrt(static_cast<double>(taskBlocks)))), frames);
+        }
+    }
+
+    if (!fits)
+    {
+        std::cout << "Image doesn't fit into memory limit, every task loads its own area" << std::endl;
+    }
+
+    //! Tuned geometry is remembered per image shape, so only the first image of a kind is measured.
+    //! Tuning needs the whole image in memory, and is done on the first frame.
+    if (!arguments.autotune.empty() && pixels)
+    {
+        const std::string key = TaskGeometryKey(shape, width, frameHeight, pool.WorkerCount());
+
+        if (!LoadTunedGeometry(arguments.autotune, key, geometry))
+        {
+            std::cout << "Tuning task geometry for " << key.c_str() << std::endl;
+
+            geometry = TuneTasks(pool, kernel, shape, pixels, stride, width, frameHeight);
+
+            if (!SaveTunedGeometry(arguments.autotune, key, geometry))
+            {
+                std::cout << "Unable to save tuned geometry to " << arguments.autotune.c_str() << std::endl;
+            }
+        }
+    }
+
+    //! Prepare the buffer to store final output, every task writes straight into its own rectangle.
+    //! It is left uninitialized, so its pages are first touched by workers writing them.
+    std::unique_ptr<uint8_t[]> outBuffer(new uint8_t[outSize]);
+
+    const uint32_t x_taskCount = (x_tiles + geometry.x_blocks - 1) / geometry.x_blocks;
+    const uint32_t frameTasks = x_taskCount * ((y_tiles + geometry.y_blocks - 1) / geometry.y_blocks);
+    const uint32_t taskCount = frameTasks * frames;
+
+    std::cout << "Total area to be processed: " << width << "x" << height << " (" << totalPixels << "px)" << std::endl;
+
+    if (frames > 1)
+    {
+        std::cout << "Image has " << frames << " frames of " << width << "x" << frameHeight << std::endl;
+    }
+
+    std::cout << "Running " << taskCount << " tasks of size " << geometry.x_blocks * shape.x << "x"
+        << geometry.y_blocks * shape.y << " on " << pool.WorkerCount() << " workers" << std::endl;
+
+    const std::vector<WorkerSnapshot> before = SnapshotStats(pool);
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::string error;
+
+    {
+        //! Progress is reported from a separate thread while workers are busy
+        Reporter reporter(pool.Stats(), pool.WorkerCount(), static_cast<uint64_t>(x_tiles) * y_tiles * frames,
+            shape.x * shape.y);
+
+        if (regions)
+        {
+            std::mutex errorMutex;
+
+            //! Consecutive tasks go to workers of the same node, so each node loads and processes its own band
+            pool.Run(taskCount, [&](WorkerPool& worker, uint32_t task){
+                const uint32_t frame = task / frameTasks;
+                const uint32_t x_first = (task % frameTasks % x_taskCount) * geometry.x_blocks;
+                const uint32_t y_first = (task % frameTasks / x_taskCount) * geometry.y_blocks;
+                const uint32_t x_count = std::min(geometry.x_blocks, x_tiles - x_first);
+                const uint32_t y_count = std::min(geometry.y_blocks, y_tiles - y_first);
+
+                try
+                {
+                    worker.ProcessImage(kernel, shape,
+                        img.extract_area(x_first * shape.x, frame * frameHeight + y_first * shape.y,
+                            x_count * shape.x, y_count * shape.y),
+                        outBuffer.get() + frame * outFrameSize + y_first * outStride + x_first * pixelBytes, outStride);
+                }
+                catch( vips::VError& e )
+                {
+                    std::lock_guard<std::mutex> lock(errorMutex);
+                    error = e.what();
+                }
+            });
+        }
+        else
+        {
+            ProcessTasks(pool, kernel, shape, pixels, stride, x_tiles, y_tiles, outBuffer.get(), outStride, geometry,
+                frames, frameHeight * stride, outFrameSize);
+        }
+    }
+
+    if (!error.empty())
+    {
+        std::cout << "Error occured while loading image " << arguments.in.c_str() << std::endl;
+        std::cerr << error << std::endl;
+        return -1;
+    }
+
+    if (arguments.pin || arguments.numa)
+    {
+        ReportNodes(pool, before, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(),
+            shape.x * shape.y);
+    }
+
+    std::cout << "Processing complete, preparing resulting image" << std::endl;
+
+    vips::VImage outImg = vips::VImage::new_from_memory(outBuffer.get(), outSize,
+        x_tiles, y_tiles * frames, shape.bands, img.format());
+
+    CopyFrames(img, outImg);
+
+    try
+    {
+        std::cout << "Saving resulting image" << std::endl;
+
+        //! Save the image
+        SaveImage(outImg, arguments.out, arguments.Encoding());
+    }
+    catch( vips::VError& e )
+    {
+        std::cout << "Error occured while saving resulting image to " << arguments.out.c_str() << std::endl;
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+int ProcessIncremental(WorkerPool& pool, const Arguments& arguments)
+{
+    vips::VImage img;
+    const uint8_t* pixels = 0;
+
+    //! Whole image is compared block by block, so it has to fit into memory limit
+    BudgetReservation reservation;
+
+    try
+    {
+        img = vips::VImage::new_from_file( arguments.in.c_str() );
+        WarnFirstFrame(img, arguments.in);
+
+        //! If both blocks are 1, we can just save the image
+        if (arguments.x_blockSize == 1 && arguments.y_blockSize == 1)
+        {
+            return SaveInput(img, arguments);
+        }
+
+        reservation.Reset(pool.Memory(), DecodedBytes(img));
+
+        ProfileSpan span("decode");
+        pixels = reinterpret_cast<const uint8_t*>(img.data());
+
+        if (!pixels)
+        {
+            throw vips::VError();
+        }
+    }
+    catch( vips::VError& e )
+    {
+        std::cout << "Error occured while opening image " << arguments.in.c_str() << std::endl;
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+
+    BlockHashes hashes;
+    hashes.width = img.width();
+    hashes.height = img.height();
+    hashes.shape = ShapeOf(img, arguments);
+    hashes.encoding = HashEncoding(arguments.Encoding());
+
+    const uint32_t x_tiles = hashes.width / hashes.shape.x;
+    const uint32_t y_tiles = hashes.height / hashes.shape.y;
+
+    if (0 == x_tiles || 0 == y_tiles)
+    {
+        std::cout << "Image " << arguments.in.c_str() << " is smaller than a single block" << std::endl;
+        return -1;
+    }
+
+    const uint32_t pixelBytes = hashes.shape.bands * hashes.shape.sampleBytes;
+    const size_t stride = static_cast<size_t>(hashes.width) * pixelBytes;
+    const size_t outStride = static_cast<size_t>(x_tiles) * pixelBytes;
+
+    HashBlocks(pool, pixels, stride, hashes);
+
+    //! Previous output is reused only if it is exactly what was saved together with previous hashes
+    BlockHashes previous;
+    std::vector<uint8_t> outBuffer(outStride * y_tiles);
+
+    const bool reuse = LoadBlockHashes(BlockHashesPath(arguments), previous) && previous.SameGeometry(hashes) &&
+        LoadPreviousOutput(arguments, previous, img, outBuffer);
+
+    //! Changed blocks of every row, as runs of [first, last) block indices
+    std::vector<std::vector<std::pair<uint32_t, uint32_t>>> runs(y_tiles);
+    std::vector<uint32_t> changedRows;
+    uint64_t changedBlocks = 0;
+
+    for (uint32_t y = 0; y < y_tiles; ++y)
+    {
+        const uint64_t* row = hashes.blocks.data() + static_cast<size_t>(y) * x_tiles;
+        const uint64_t* previousRow = reuse ? previous.blocks.data() + static_cast<size_t>(y) * x_tiles : 0;
+
+        for (uint32_t x = 0; x < x_tiles; ++x)
+        {
+            if (previousRow && row[x] == previousRow[x])
+            {
+                continue;
+            }
+
+            if (!runs[y].empty() && runs[y].back().second == x)
+            {
+                ++runs[y].back().second;
+            }
+            else
+            {
+                runs[y].push_back(std::make_pair(x, x + 1));
+            }
+
+            ++changedBlocks;
+        }
+
+        if (!runs[y].empty())
+        {
+            changedRows.push_back(y);
+        }
+    }
+
+    if (reuse)
+    {
+        std::cout << changedBlocks << " of " << hashes.blocks.size() << " blocks changed since previous run" << std::endl;
+    }
+    else
+    {
+        std::cout << "No usable previous result, processing every block" << std::endl;
+    }
+
+    if (reuse && 0 == changedBlocks && previous.encoding == hashes.encoding)
+    {
+        std::cout << "Resulting image is up to date" << std::endl;
+        return 0;
+    }
+
+    {
+        const DominantColorKernel kernel = SelectDominantColorKernel(hashes.shape);
+
+        Reporter reporter(pool.Stats(), pool.WorkerCount(), changedBlocks, hashes.shape.x * hashes.shape.y);
+
+        //! One task per block row with changes, every run of changed blocks is processed at once
+        pool.Run(changedRows.size(), [&](WorkerPool& worker, uint32_t index){
+            const uint32_t y = changedRows[index];
+            const uint8_t* blockRow = pixels + static_cast<size_t>(y) * hashes.shape.y * stride;
+            uint8_t* outRow = outBuffer.data() + y * outStride;
+
+            for (const std::pair<uint32_t, uint32_t>& run : runs[y])
+            {
+                worker.ProcessArea(kernel, hashes.shape, blockRow + run.first * hashes.shape.x * pixelBytes, stride,
+                    (run.second - run.first) * hashes.shape.x, hashes.shape.y, outRow + run.first * pixelBytes, outStride);
+            }
+        });
+    }
+
+    hashes.output = HashBytes(outBuffer.data(), outBuffer.size());
+
+    vips::VImage outImg = vips::VImage::new_from_memory(outBuffer.data(), outBuffer.size(),
+        x_tiles, y_tiles, hashes.shape.bands, img.format());
+
+    try
+    {
+        std::cout << "Saving resulting image" << std::endl;
+
+        SaveImage(outImg, arguments.out, arguments.Encoding());
+    }
+    catch( vips::VError& e )
+    {
+        std::cout << "Error occured while saving resulting image to " << arguments.out.c_str() << std::endl;
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+
+    //! Without hashes next run simply processes every block again
+    if (!SaveBlockHashes(BlockHashesPath(arguments), hashes))
+    {
+        std::cout << "Unable to save block hashes to " << BlockHashesPath(arguments).c_str() << std::endl;
+    }
+
+    return 0;
+}
+
+int ProcessPyramid(WorkerPool& pool, const Arguments& arguments)
+{
+    std::vector<BlockSize> sizes;
+
+    if (!ParseBlockSizes(arguments.pyramid, sizes))
+    {
+        std::cout << "Invalid pyramid block sizes " << arguments.pyramid.c_str() << std::endl;
+        return -1;
+    }
+
+    vips::VImage img;
+    const uint8_t* pixels = 0;
+
+    //! Every level is built from the same decode, so the whole image has to fit into memory limit
+    BudgetReservation reservation;
+
+    try
+    {
+        ProfileSpan span("decode");
+        img = vips::VImage::new_from_file( arguments.in.c_str() );
+        WarnFirstFrame(img, arguments.in);
+        reservation.Reset(pool.Memory(), DecodedBytes(img));
+        pixels = reinterpret_cast<const uint8_t*>(img.data());
+
+        if (!pixels)
+        {
+            throw vips::VError();
+        }
+    }
+    catch( vips::VError& e )
+    {
+        std::cout << "Error occured while opening image " << arguments.in.c_str() << std::endl;
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+
+    std::vector<BlockShape> levels;
+
+    for (const BlockSize& size : sizes)
+    {
+        Arguments level = arguments;
+        level.x_blockSize = size.first;
+        level.y_blockSize = size.second;
+
+        levels.push_back(ShapeOf(img, level));
+    }
+
+    const size_t stride = static_cast<size_t>(img.width()) * levels[0].bands * levels[0].sampleBytes;
+    std::vector<DownscaledImage> results;
+
+    std::cout << "Processing " << levels.size() << " levels of " << img.width() << "x" << img.height() << " image" << std::endl;
+
+    try
+    {
+        results = DownscalePyramid(pool, pixels, stride, img.width(), img.height(), levels, arguments.taskBlockSide);
+    }
+    catch( vips::VError& e )
+    {
+        std::cout << "Error occured while processing image " << arguments.in.c_str() << std::endl;
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+
+    for (size_t l = 0; l < results.size(); ++l)
+    {
+        const std::string out = PyramidLevelPath(arguments.out, sizes[l]);
+
+        vips::VImage outImg = vips::VImage::new_from_memory(results[l].pixels.data(), results[l].pixels.size(),
+            results[l].width, results[l].height, results[l].bands, img.format());
+
+        try
+        {
+            std::cout << "Saving " << out.c_str() << std::endl;
+
+            SaveImage(outImg, out, arguments.Encoding());
+        }
+        catch( vips::VError& e )
+        {
+            std::cout << "Error occured while saving resulting image to " << out.c_str() << std::endl;
+            std::cerr << e.what() << std::endl;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int ProcessStream(WorkerPool& pool, const Arguments& arguments)
+{
+    vips::VImage img;
+
+    if (!OpenSequential(arguments, img))
+    {
+        return -1;
+    }
+
+    //! If both blocks are 1, we can just save the image
+    if (arguments.x_blockSize == 1 && arguments.y_blockSize == 1)
+    {
+        return SaveInput(img, arguments);
+    }
+
+    const uint32_t bandCount = img.bands();
+    const uint32_t x_tiles = img.width() / arguments.x_blockSize;
+    const uint32_t y_tiles = img.height() / arguments.y_blockSize;
+
+    const StripPlan plan = PlanStrips(arguments, img, pool);
+    const BlockShape shape = ShapeOf(img, arguments);
+
+    const DominantColorKernel kernel = SelectDominantColorKernel(shape);
+
+    //! Finished output rows go to a temporary file right away, it is encoded once complete
+    VipsImage* outRows = vips_image_new_temp_file("%s.v");
+
+    if (!outRows)
+    {
+        std::cout << "Error occured while preparing resulting image" << std::endl;
+        std::cerr << vips_error_buffer() << std::endl;
+        return -1;
+    }
+
+    vips::VImage outImg(outRows);
+
+    vips_image_init_fields(outRows, x_tiles, y_tiles, bandCount, img.format(), VIPS_CODING_NONE,
+        img.interpretation(), img.xres(), img.yres());
+
+    if (vips_image_write_prepare(outRows))
+    {
+        std::cout << "Error occured while preparing resulting image" << std::endl;
+        std::cerr << vips_error_buffer() << std::endl;
+        return -1;
+    }
+
+    const size_t outStride = x_tiles * bandCount * shape.sampleBytes;
+    std::vector<uint8_t> outStrip(plan.stripTiles * outStride);
+
+    std::cout << "Total area to be processed: " << img.width() << "x" << img.height() << " (" << img.width() * img.height() << "px)" << std::endl;
+    std::cout << "Streaming " << plan.stripCount << " strips of " << plan.stripTiles * arguments.y_blockSize << " rows" << std::endl;
+
+    std::unique_ptr<Reporter> reporter(new Reporter(pool.Stats(), pool.WorkerCount(),
+        static_cast<uint64_t>(x_tiles) * y_tiles, arguments.x_blockSize * arguments.y_blockSize));
+
+    for (uint32_t index = 0; index < plan.stripCount; ++index)
+    {
+        Strip strip;
+
+        try
+        {
+            strip = LoadStrip(img, arguments, plan, index);
+        }
+        catch( vips::VError& e )
+        {
+            std::cout << "Error occured while reading image " << arguments.in.c_str() << std::endl;
+            std::cerr << e.what() << std::endl;
+            return -1;
+        }
+
+        ProcessStrip(pool, kernel, shape, plan, strip, outStrip.data(), outStride);
+
+        //! Hand finished rows over
+        ProfileSpan span("assemble");
+
+        for (uint32_t y = 0; y < strip.y_count; ++y)
+        {
+            if (vips_image_write_line(outRows, strip.y_first + y, outStrip.data() + y * outStride))
+            {
+                std::cout << "Error occured while preparing resulting image" << std::endl;
+                std::cerr << vips_error_buffer() << std::endl;
+                return -1;
+            }
+        }
+    }
+
+    reporter.reset();
+
+    std::cout << "Processing complete, saving resulting image" << std::endl;
+
+    try
+    {
+        SaveImage(outImg, arguments.out, arguments.Encoding());
+    }
+    catch( vips::VError& e )
+    {
+        std::cout << "Error occured while saving resulting image to " << arguments.out.c_str() << std::endl;
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+int ProcessPipeline(WorkerPool& pool, const Arguments& arguments)
+{
+    vips::VImage img;
+
+    if (!OpenSequential(arguments, img))
+    {
+        return -1;
+    }
+
+    //! If both blocks are 1, we can just save the image
+    if (arguments.x_blockSize == 1 && arguments.y_blockSize == 1)
+    {
+        return SaveInput(img, arguments);
+    }
+
+    const uint32_t x_tiles = img.width() / arguments.x_blockSize;
+    const uint32_t y_tiles = img.height() / arguments.y_blockSize;
+
+    const StripPlan plan = PlanStrips(arguments, img, pool);
+    const BlockShape shape = ShapeOf(img, arguments);
+
+    const DominantColorKernel kernel = SelectDominantColorKernel(shape);
+
+    //! Encoder reads output rows straight from here as soon as they are marked ready
+    ProgressiveImage output(x_tiles, y_tiles, shape.bands, img);
+
+    //! Strips decoded ahead of processing, bounded so decoding can't run away with memory
+    BoundedQueue<Strip> decoded(s_pipelineDepth);
+
+    std::string decodeError;
+    std::string encodeError;
+
+    std::cout << "Total area to be processed: " << img.width() << "x" << img.height() << " (" << img.width() * img.height() << "px)" << std::endl;
+    std::cout << "Pipelining " << plan.stripCount << " strips of " << plan.stripTiles * arguments.y_blockSize << " rows" << std::endl;
+
+    std::unique_ptr<Reporter> reporter(new Reporter(pool.Stats(), pool.WorkerCount(),
+        static_cast<uint64_t>(x_tiles) * y_tiles, arguments.x_blockSize * arguments.y_blockSize));
+
+    //! Decode stage
+    std::thread decoder([&]{
+        Profiler::NameThread("decoder");
+
+        for (uint32_t index = 0; index < plan.stripCount; ++index)
+        {
+            try
+            {
+                if (!decoded.Push(LoadStrip(img, arguments, plan, index)))
+                {
+                    break;
+                }
+            }
+            catch( vips::VError& e )
+            {
+                decodeError = e.what();
+                break;
+            }
+        }
+
+        decoded.Close();
+    });
+
+    //! Encode stage
+    std::thread encoder([&]{
+        Profiler::NameThread("encoder");
+
+        try
+        {
+            SaveImage(output.Image(), arguments.out, arguments.Encoding());
+        }
+        catch( vips::VError& e )
+        {
+            encodeError = e.what();
+
+            //! Nobody will take the results, stop the other stages
+            decoded.Close();
+        }
+    });
+
+    //! Compute stage
+    uint32_t readyRows = 0;
+    Strip strip;
+
+    while (decoded.Pop(strip))
+    {
+        ProcessStrip(pool, kernel, shape, plan, strip, output.Row(strip.y_first), output.Stride());
+
+        ProfileSpan span("assemble");
+
+        readyRows = strip.y_first + strip.y_count;
+        output.MarkRowsReady(readyRows);
+    }
+
+    if (readyRows < y_tiles)
+    {
+        output.Abort();
+    }
+
+    decoder.join();
+    encoder.join();
+
+    reporter.reset();
+
+    if (!decodeError.empty())
+    {
+        std::cout << "Error occured while reading image " << arguments.in.c_str() << std::endl;
+        std::cerr << decodeError << std::endl;
+        return -1;
+    }
+
+    if (!encodeError.empty())
+    {
+        std::cout << "Error occured while saving resulting image to " << arguments.out.c_str() << std::endl;
+        std::cerr << encodeError << std::endl;
+        return -1;
+    }
+
+    std::cout << "Processing and saving complete" << std::endl;
+
+    return 0;
+}
+
+int ProcessSingle(WorkerPool& pool, const Arguments& arguments, ResultCache* cache)
+{
+    std::string key;
+
+    if (cache && FetchCached(*cache, arguments, key))
+    {
+        std::cout << "Result of " << arguments.in.c_str() << " found in cache" << std::endl;
+        return 0;
+    }
+
+    const int retVal = ProcessUncached(pool, arguments);
+
+    if (0 == retVal && !key.empty())
+    {
+        cache->Store(key, arguments.out);
+    }
+
+    return retVal;
+}
+
+bool FetchCached(ResultCache& cache, const Arguments& arguments, std::string& key)
+{
+    try
+    {
+        key = cache.Key(arguments.in, arguments.x_blockSize, arguments.y_blockSize, arguments.Encoding(),
+            arguments.AllFrames());
+    }
+    catch( vips::VError& )
+    {
+        //! Whoever decodes the input reports the error
+        key.clear();
+        return false;
+    }
+
+    return cache.Fetch(key, arguments.out);
+}
+
+void WarnFirstFrame(const vips::VImage& img, const std::string& path)
+{
+    const int frames = vips_image_get_n_pages(img.get_image());
+
+    if (frames > 1)
+    {
+        std::cout << "Image " << path.c_str() << " has " << frames << " frames, only the first one is processed"
+            " in this mode" << std::endl;
+    }
+}
+
+int ProcessBatch(WorkerPool& pool, const Arguments& arguments, ResultCache* cache)
+{
+    std::vector<std::string> inputs;
+
+    if (!ListBatchInputs(arguments.in, inputs))
+    {
+        std::cout << "Error occured while reading batch input " << arguments.in.c_str() << std::endl;
+        return -1;
+    }
+
+    std::vector<Arguments> small;
+    std::vector<Arguments> large;
+    uint64_t totalSmallBlocks = 0;
+    uint32_t failed = 0;
+    uint32_t cached = 0;
+
+    //! Cache entry keys to store results under, in small and large order
+    std::vector<std::string> smallKeys;
+    std::vector<std::string> largeKeys;
+
+    //! Every output gets extension of the format requested, PNG by default
+    const OutputFormat format = arguments.Encoding().format;
+
+    for (const std::string& in : inputs)
+    {
+        //! Output keeps input file name, with extension of the format requested
+        const size_t nameStart = in.find_last_of("/\\") + 1;
+        const size_t extension = in.find_last_of('.');
+        const size_t nameLength = (extension == std::string::npos || extension < nameStart) ? std::string::npos : extension - nameStart;
+
+        Arguments image = arguments;
+        image.in = in;
+        image.out = arguments.out + "/" + in.substr(nameStart, nameLength) + OutputFormatExtension(format);
+
+        std::string key;
+
+        if (cache && FetchCached(*cache, image, key))
+        {
+            ++cached;
+            continue;
+        }
+
+        //! Only the header is read here, pixels are loaded by whoever processes the image
+        uint64_t blocks = 0;
+        uint64_t smallBlocks = 0;
+        bool fits = true;
+
+        try
+        {
+            vips::VImage img = OpenFrames(in);
+            const uint32_t frameHeight = FrameHeight(img);
+
+            blocks = static_cast<uint64_t>(img.width() / arguments.x_blockSize) * (frameHeight / arguments.y_blockSize) *
+                (img.height() / frameHeight);
+
+            //! Images that fit into a single task are processed whole, several at once
+            const BlockShape shape = ShapeOf(img, arguments);
+            smallBlocks = TaskBlockLimit(shape, arguments.taskBlockSide);
+
+            //! With memory limited, every worker shall be able to hold one with its output and indices
+            fits = !pool.Memory() ||
+                WholeBytes(img, shape, arguments.palette) <= pool.Memory()->Limit() / pool.WorkerCount();
+        }
+        catch( vips::VError& e )
+        {
+            std::cout << "Error occured while opening image " << in.c_str() << std::endl;
+            std::cerr << e.what() << std::endl;
+            ++failed;
+            continue;
+        }
+
+        if (blocks <= smallBlocks && fits)
+        {
+            small.push_back(image);
+            smallKeys.push_back(key);
+            totalSmallBlocks += blocks;
+        }
+        else
+        {
+            large.push_back(image);
+            largeKeys.push_back(key);
+        }
+    }
+
+    std::cout << "Batch of " << inputs.size() << " images: " << cached << " found in cache, " << small.size()
+        << " processed whole in parallel, " << large.size() << " split between workers" << std::endl;
+
+    std::vector<std::string> errors(small.size());
+
+    {
+        Reporter reporter(pool.Stats(), pool.WorkerCount(), totalSmallBlocks,
+            arguments.x_blockSize * arguments.y_blockSize);
+
+        pool.Run(small.size(), [&](WorkerPool& worker, uint32_t index){
+            try
+            {
+                ProcessWhole(worker, small[index]);
+            }
+            catch( vips::VError& e )
+            {
+                errors[index] = e.what();
+            }
+        });
+    }
+
+    for (uint32_t i = 0; i < small.size(); ++i)
+    {
+        if (!errors[i].empty())
+        {
+            std::cout << "Error occured while processing image " << small[i].in.c_str() << std::endl;
+            std::cerr << errors[i] << std::endl;
+            ++failed;
+        }
+        else if (!smallKeys[i].empty())
+        {
+            cache->Store(smallKeys[i], small[i].out);
+        }
+    }
+
+    for (uint32_t i = 0; i < large.size(); ++i)
+    {
+        std::cout << "Processing " << large[i].in.c_str() << std::endl;
+
+        if (0 != ProcessUncached(pool, large[i]))
+        {
+            ++failed;
+        }
+        else if (!largeKeys[i].empty())
+        {
+            cache->Store(largeKeys[i], large[i].out);
+        }
+    }
+
+    std::cout << "Batch complete, " << inputs.size() - failed << "/" << inputs.size() << " images processed" << std::endl;
+
+    return failed ? -1 : 0;
+}
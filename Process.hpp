@@ -0,0 +1,189 @@
+/*
+* Copyright (c) 2017 Dmitry Odintsov
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#ifndef ANINISCALE_PROCESS_HPP
+#define ANINISCALE_PROCESS_HPP
+
+#include "Encoder.hpp"
+#include "Pyramid.hpp"
+#include "ResultCache.hpp"
+#include "WorkerPool.hpp"
+
+#include <string>
+#include <vector>
+
+struct Arguments
+{
+    // Required
+    std::string in;
+    std::string out;
+
+    // Optional
+    int x_blockSize = 8;
+    int y_blockSize = 8;
+    int taskBlockSide = 0;  // 0 to pick task size from cache size and worker count
+    int workers = 0;        // 0 for one per hardware thread
+    std::string autotune;   // file to remember tuned task geometries in, empty to plan them
+    bool pin = false;       // pin workers to CPUs
+    bool numa = false;      // pin workers and give every NUMA node its own band of the image
+    int maxMemory = 0;      // in megabytes, 0 for no limit
+    int reportingTimeout = 5;
+    bool stream = false;
+    bool pipeline = false;
+    bool batch = false;
+    bool incremental = false;
+    std::string pyramid;    // block sizes to save at once, empty for -x/-y only
+    bool help = false;
+
+    // Profiling
+    std::string profile;    // file to write Chrome trace of the run to, empty to disable
+    bool perfCounters = false;  // count cycles, instructions and cache misses of compute spans
+
+    // Output encoding
+    std::string format;     // empty to pick by output extension
+    int compression = -1;   // -1 for encoder default
+    std::string pngFilter;  // empty for encoder default
+    bool palette = false;   // save images of up to 256 colors as indexed PNG
+
+    // Server mode
+    std::string serve;      // socket to serve requests on
+    std::string connect;    // socket of the server to send request to
+    bool shm = false;       // hand pixels over to the server in shared memory
+
+    // Result cache
+    std::string cache;      // cache directory, empty to disable
+    int cacheSize = 1024;   // in megabytes
+
+    //! Returns the validity of argument set
+    bool IsValid() const
+    {
+        int filter = 0;
+        std::vector<BlockSize> sizes;
+
+        // arguments are valid only if:
+        return (!serve.empty() || (!in.empty() && !out.empty())) &&   // both in and out are set unless serving
+            !help &&                            // -h/--help is not set
+            x_blockSize >= 1 && y_blockSize >= 1 &&     // x and y block sizes are positive integers
+            taskBlockSide >= 0 && workers >= 0 &&       // task side and worker count are automatic or positive
+            maxMemory >= 0 &&                           // memory is either limited or not
+            !(!autotune.empty() && taskBlockSide > 0) &&    // task size is either tuned or given
+            !(!autotune.empty() && numa) &&             // tuning needs the whole image loaded up front
+            !(perfCounters && profile.empty()) &&       // counters go to the trace
+            !(incremental && (stream || pipeline)) &&   // incremental mode needs the whole image
+            (pyramid.empty() || (ParseBlockSizes(pyramid, sizes) &&     // pyramid levels are nested
+                !stream && !pipeline && !incremental && !batch && cache.empty())) &&   // and saved by a mode of its own
+            (format.empty() || ParseOutputFormat(format) != OUTPUT_FORMAT_UNKNOWN) &&  // format is supported
+            compression >= -1 && compression <= 9 &&    // compression is a zlib level
+            cacheSize >= 1 &&                           // cache can hold something
+            (pngFilter.empty() || ParsePngFilter(pngFilter, filter)) &&    // filters are known
+            !(palette && (Encoding().format != OUTPUT_FORMAT_PNG ||     // palette is written to PNG only
+                stream || pipeline || incremental || numa || !pyramid.empty() ||    // of whole images in memory
+                !serve.empty() || !connect.empty())) &&   // by this process
+            !(shm && connect.empty()) &&                // shared memory is how the client hands pixels over
+            !(!connect.empty() && (!serve.empty() || batch || !pyramid.empty() ||  // client sends a plain request
+                stream || pipeline || incremental || !cache.empty() || maxMemory > 0)) &&  // and runs no mode here
+            !(!serve.empty() && (batch || !pyramid.empty()));  // server takes its images from requests
+    }
+
+    //! Returns whether every frame of multi-page input is processed, other modes take the first one only
+    bool AllFrames() const
+    {
+        return !stream && !pipeline && !incremental && pyramid.empty() && serve.empty() && connect.empty();
+    }
+
+    //! Returns output encoder settings, format falls back to output extension and then to PNG
+    EncoderOptions Encoding() const
+    {
+        EncoderOptions options;
+        options.format = ParseOutputFormat(format);
+
+        if (options.format == OUTPUT_FORMAT_UNKNOWN)
+        {
+            options.format = OutputFormatFromPath(out);
+        }
+
+        if (options.format == OUTPUT_FORMAT_UNKNOWN)
+        {
+            options.format = OUTPUT_FORMAT_PNG;
+        }
+
+        options.compression = compression;
+
+        if (pngFilter.empty() || !ParsePngFilter(pngFilter, options.pngFilter))
+        {
+            options.pngFilter = -1;
+        }
+
+        options.palette = palette;
+
+        return options;
+    }
+};
+
+/** @brief  Downscales image loaded to memory as a whole
+ *
+ *  @return 0 on success, error is printed otherwise
+ */
+int Process(WorkerPool& pool, const Arguments& arguments);
+
+/** @brief  Downscales image read sequentially in strips of block rows
+ *
+ *  @return 0 on success, error is printed otherwise
+ */
+int ProcessStream(WorkerPool& pool, const Arguments& arguments);
+
+/** @brief  Like ProcessStream(), but decodes, processes and encodes strips concurrently
+ *
+ *  @return 0 on success, error is printed otherwise
+ */
+int ProcessPipeline(WorkerPool& pool, const Arguments& arguments);
+
+/** @brief  Downscales image loaded to memory as a whole, reusing unchanged blocks of previous result
+ *
+ *  Hashes of input blocks are saved next to the output. On the next run
+ *  only blocks whose hashes changed are processed again and patched into
+ *  the previous output, provided it was not modified in between.
+ *
+ *  @return 0 on success, error is printed otherwise
+ */
+int ProcessIncremental(WorkerPool& pool, const Arguments& arguments);
+
+/** @brief  Downscales image loaded to memory as a whole with every block size of arguments.pyramid
+ *
+ *  Every level is saved next to the output, with block size appended to its name
+ *
+ *  @return 0 on success, error is printed otherwise
+ */
+int ProcessPyramid(WorkerPool& pool, const Arguments& arguments);
+
+/** @brief  Downscales a single image in the mode requested by @p arguments
+ *
+ *  @param  cache   results to look up before processing and to add result to, may be null
+ *
+ *  @return 0 on success, error is printed otherwise
+ */
+int ProcessSingle(WorkerPool& pool, const Arguments& arguments, ResultCache* cache = 0);
+
+/** @brief  Downscales every image listed by @p arguments
+ *
+ *  @param  cache   results to look up before processing and to add results to, may be null
+ *
+ *  @return 0 if every image was processed, error is printed otherwise
+ */
+int ProcessBatch(WorkerPool& pool, const Arguments& arguments, ResultCache* cache = 0);
+
+/** @brief  Looks result of @p arguments up in @p cache and copies it to the output on a hit
+ *
+ *  @param  key     set to entry key to store the result under on a miss, empty if input can't be read
+ *
+ *  @return true on a hit
+ */
+bool FetchCached(ResultCache& cache, const Arguments& arguments, std::string& key);
+
+//! Tells that only the first frame of @p img, opened from @p path, is processed if it has more
+void WarnFirstFrame(const vips::VImage& img, const std::string& path);
+
+#endif // ANINISCALE_PROCESS_HPP
@@ -0,0 +1,281 @@
+/*
+* Copyright (c) 2017 Dmitry Odintsov
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "Profiler.hpp"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+//! Hardware counters read for compute spans, in trace argument order
+static const char* s_counterNames[] = { "cycles", "instructions", "cache_misses" };
+static const uint32_t s_counterCount = sizeof(s_counterNames) / sizeof(s_counterNames[0]);
+
+std::atomic<bool> Profiler::s_enabled(false);
+
+namespace
+{
+
+//! Recorded span
+struct Event
+{
+    const char* name;
+    uint64_t start;
+    uint64_t end;
+
+    //! Counter deltas, valid if hasCounters is set
+    uint64_t counters[s_counterCount];
+    bool hasCounters;
+};
+
+//! Spans of a single thread
+struct ThreadBuffer
+{
+    uint32_t id;
+    std::string name;
+    std::vector<Event> events;
+
+    //! Counter group leader, -1 if counters are not open for this thread
+    int counterGroup;
+};
+
+//! Every buffer ever created, they outlive their threads
+std::mutex s_buffersMutex;
+std::vector<std::unique_ptr<ThreadBuffer>> s_buffers;
+
+std::chrono::steady_clock::time_point s_start;
+bool s_counters = false;
+
+thread_local ThreadBuffer* t_buffer = 0;
+
+/** @brief  Opens cycle, instruction and cache miss counters of calling thread as a group
+ *
+ *  @return group leader, -1 if counters can't be opened
+ */
+int OpenCounters()
+{
+#ifdef __linux__
+    static const uint64_t configs[s_counterCount] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES,
+    };
+
+    int group = -1;
+
+    for (uint32_t i = 0; i < s_counterCount; ++i)
+    {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = configs[i];
+        attr.read_format = PERF_FORMAT_GROUP;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        //! Calling thread on any CPU
+        const int fd = syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+
+        if (fd < 0)
+        {
+            if (group >= 0)
+            {
+                close(group);
+            }
+
+            return -1;
+        }
+
+        if (group < 0)
+        {
+            group = fd;
+        }
+    }
+
+    return group;
+#else
+    return -1;
+#endif
+}
+
+//! Returns buffer of calling thread, created on first use
+ThreadBuffer& Buffer()
+{
+    if (!t_buffer)
+    {
+        std::unique_ptr<ThreadBuffer> buffer(new ThreadBuffer);
+        buffer->counterGroup = s_counters ? OpenCounters() : -1;
+
+        std::lock_guard<std::mutex> lock(s_buffersMutex);
+        buffer->id = s_buffers.size();
+
+        std::ostringstream name;
+        name << "thread " << buffer->id;
+        buffer->name = name.str();
+
+        t_buffer = buffer.get();
+        s_buffers.push_back(std::move(buffer));
+    }
+
+    return *t_buffer;
+}
+
+} // namespace
+
+void Profiler::Enable(bool counters)
+{
+    s_start = std::chrono::steady_clock::now();
+    s_counters = counters;
+
+    if (counters && Buffer().counterGroup < 0)
+    {
+        std::cout << "Hardware counters are not available, profiling without them" << std::endl;
+        s_counters = false;
+    }
+
+    s_enabled = true;
+}
+
+void Profiler::NameThread(const std::string& name)
+{
+    if (Enabled())
+    {
+        Buffer().name = name;
+    }
+}
+
+uint64_t Profiler::Now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - s_start).count();
+}
+
+void Profiler::Record(const char* name, uint64_t start, uint64_t end)
+{
+    Record(name, start, end, 0);
+}
+
+void Profiler::Record(const char* name, uint64_t start, uint64_t end, const uint64_t* counters)
+{
+    Event event;
+    event.name = name;
+    event.start = start;
+    event.end = end;
+    event.hasCounters = counters != 0;
+
+    if (counters)
+    {
+        memcpy(event.counters, counters, sizeof(event.counters));
+    }
+
+    Buffer().events.push_back(event);
+}
+
+bool Profiler::ReadCounters(uint64_t* values)
+{
+#ifdef __linux__
+    const int group = s_counters ? Buffer().counterGroup : -1;
+
+    //! Group is read at once: number of counters, then their values
+    uint64_t data[1 + s_counterCount];
+
+    if (group < 0 || read(group, data, sizeof(data)) != static_cast<ssize_t>(sizeof(data)) || data[0] != s_counterCount)
+    {
+        return false;
+    }
+
+    memcpy(values, data + 1, s_counterCount * sizeof(uint64_t));
+
+    return true;
+#else
+    (void)values;
+    return false;
+#endif
+}
+
+bool Profiler::Write(const std::string& path)
+{
+    std::ofstream file(path.c_str(), std::ios::trunc);
+    file << std::fixed << std::setprecision(3);
+
+    //! Complete events, timestamps in microseconds
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+    bool first = true;
+    std::lock_guard<std::mutex> lock(s_buffersMutex);
+
+    for (const std::unique_ptr<ThreadBuffer>& buffer : s_buffers)
+    {
+        file << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->id
+            << ",\"args\":{\"name\":\"" << buffer->name << "\"}}";
+        first = false;
+
+        for (const Event& event : buffer->events)
+        {
+            file << ",\n{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->id
+                << ",\"ts\":" << event.start / 1e3 << ",\"dur\":" << (event.end - event.start) / 1e3;
+
+            if (event.hasCounters)
+            {
+                file << ",\"args\":{";
+
+                for (uint32_t i = 0; i < s_counterCount; ++i)
+                {
+                    file << (i ? "," : "") << "\"" << s_counterNames[i] << "\":" << event.counters[i];
+                }
+
+                file << "}";
+            }
+
+            file << "}";
+        }
+    }
+
+    file << "\n]}\n";
+
+    return static_cast<bool>(file.flush());
+}
+
+void ProfileSpan::Begin(bool counters)
+{
+    m_counters = counters && Profiler::ReadCounters(m_values);
+    m_start = Profiler::Now();
+}
+
+void ProfileSpan::End()
+{
+    const uint64_t end = Profiler::Now();
+
+    if (m_counters)
+    {
+        uint64_t values[s_counterCount];
+
+        if (Profiler::ReadCounters(values))
+        {
+            for (uint32_t i = 0; i < s_counterCount; ++i)
+            {
+                values[i] -= m_values[i];
+            }
+
+            Profiler::Record(m_name, m_start, end, values);
+            return;
+        }
+    }
+
+    Profiler::Record(m_name, m_start, end, 0);
+}
@@ -0,0 +1,115 @@
+/*
+* Copyright (c) 2017 Dmitry Odintsov
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#ifndef ANINISCALE_PROFILER_HPP
+#define ANINISCALE_PROFILER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/** @brief  Records timestamped spans of every thread and writes them out as Chrome trace
+ *
+ *  Spans go to a buffer owned by the recording thread, so nothing is shared
+ *  while recording. Disabled profiler costs a single relaxed load per span.
+ */
+class Profiler
+{
+public:
+    /** @brief  Starts recording
+     *
+     *  @param  counters    also count cycles, instructions and cache misses of compute spans,
+     *                      ignored with a note if hardware counters are not available
+     */
+    static void Enable(bool counters);
+
+    //! Checks whether spans are recorded
+    static bool Enabled()
+    {
+        return s_enabled.load(std::memory_order_relaxed);
+    }
+
+    //! Names calling thread in the trace, threads are numbered otherwise
+    static void NameThread(const std::string& name);
+
+    //! Returns nanoseconds since recording started
+    static uint64_t Now();
+
+    /** @brief  Adds a span of calling thread
+     *
+     *  @param  name    phase name, shall outlive the profiler
+     */
+    static void Record(const char* name, uint64_t start, uint64_t end);
+
+    /** @brief  Writes spans of every thread to a file in Chrome trace event format
+     *
+     *  Open it in chrome://tracing or Perfetto.
+     *
+     *  @attention  shall be called once no thread records spans any more
+     *
+     *  @return false if file can't be written
+     */
+    static bool Write(const std::string& path);
+
+private:
+    friend class ProfileSpan;
+
+    /** @brief  Reads hardware counters of calling thread
+     *
+     *  @return false if they are not enabled or can't be read
+     */
+    static bool ReadCounters(uint64_t* values);
+
+    //! Adds a span with counter deltas
+    static void Record(const char* name, uint64_t start, uint64_t end, const uint64_t* counters);
+
+    //! Set while recording
+    static std::atomic<bool> s_enabled;
+};
+
+//! Records a span from construction to destruction, if profiler is enabled
+class ProfileSpan
+{
+public:
+    /** @brief  Starts a span
+     *
+     *  @param  name        phase name, shall outlive the profiler
+     *  @param  counters    read hardware counters at both ends of the span
+     */
+    explicit ProfileSpan(const char* name, bool counters = false)
+        : m_name(Profiler::Enabled() ? name : 0)
+        , m_start(0)
+        , m_counters(false)
+    {
+        if (m_name)
+        {
+            Begin(counters);
+        }
+    }
+
+    //! Ends the span
+    ~ProfileSpan()
+    {
+        if (m_name)
+        {
+            End();
+        }
+    }
+
+private:
+    void Begin(bool counters);
+    void End();
+
+    //! Null if profiler was disabled when the span started
+    const char* m_name;
+    uint64_t m_start;
+
+    //! Cycles, instructions and cache misses at the start, valid if m_counters is set
+    uint64_t m_values[3];
+    bool m_counters;
+};
+
+#endif // ANINISCALE_PROFILER_HPP
@@ -0,0 +1,87 @@
+/*
+* Copyright (c) 2017 Dmitry Odintsov
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "ProgressiveImage.hpp"
+
+#include <cstring>
+
+ProgressiveImage::ProgressiveImage(uint32_t width, uint32_t height, uint32_t bands, const vips::VImage& like)
+    : m_buffer(static_cast<size_t>(width) * height * bands * vips_format_sizeof(like.format()))
+    , m_stride(static_cast<size_t>(width) * bands * vips_format_sizeof(like.format()))
+    , m_pixelBytes(bands * vips_format_sizeof(like.format()))
+    , m_readyRows(0)
+    , m_aborted(false)
+{
+    VipsImage* image = vips_image_new();
+
+    vips_image_init_fields(image, width, height, bands, like.format(), VIPS_CODING_NONE,
+        like.interpretation(), like.xres(), like.yres());
+
+    //! Encoders read top to bottom a few rows at a time, which is exactly how rows become ready
+    vips_image_pipelinev(image, VIPS_DEMAND_STYLE_THINSTRIP, NULL);
+    vips_image_generate(image, NULL, &ProgressiveImage::Generate, NULL, this, NULL);
+
+    m_image = vips::VImage(image);
+}
+
+vips::VImage ProgressiveImage::Image() const
+{
+    return m_image;
+}
+
+uint8_t* ProgressiveImage::Row(uint32_t y)
+{
+    return m_buffer.data() + y * m_stride;
+}
+
+size_t ProgressiveImage::Stride() const
+{
+    return m_stride;
+}
+
+void ProgressiveImage::MarkRowsReady(uint32_t rows)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_readyRows = rows;
+    m_ready.notify_all();
+}
+
+void ProgressiveImage::Abort()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_aborted = true;
+    m_ready.notify_all();
+}
+
+int ProgressiveImage::Generate(VipsRegion* region, void*, void* self, void*, gboolean*)
+{
+    ProgressiveImage* image = static_cast<ProgressiveImage*>(self);
+    const VipsRect& rect = region->valid;
+    const uint32_t bottom = rect.top + rect.height;
+
+    {
+        std::unique_lock<std::mutex> lock(image->m_mutex);
+        image->m_ready.wait(lock, [&]{ return image->m_aborted || image->m_readyRows >= bottom; });
+
+        if (image->m_readyRows < bottom)
+        {
+            vips_error("aniniscale", "%s", "processing stopped before image was complete");
+            return -1;
+        }
+    }
+
+    //! Rows above m_readyRows are never written again, so they are read without the lock
+    for (int y = rect.top; y < rect.top + rect.height; ++y)
+    {
+        std::memcpy(VIPS_REGION_ADDR(region, rect.left, y),
+            image->m_buffer.data() + y * image->m_stride + rect.left * image->m_pixelBytes,
+            rect.width * image->m_pixelBytes);
+    }
+
+    return 0;
+}
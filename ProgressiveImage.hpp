@@ -0,0 +1,73 @@
+/*
+* Copyright (c) 2017 Dmitry Odintsov
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#ifndef ANINISCALE_PROGRESSIVE_IMAGE_HPP
+#define ANINISCALE_PROGRESSIVE_IMAGE_HPP
+
+#include <vips/vips8>
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+/** @brief  Image that can be saved while its rows are still being computed
+ *
+ *  Wraps a memory buffer into a libvips image whose pixels are produced on
+ *  demand. When the encoder asks for rows that are not complete yet, it
+ *  waits until MarkRowsReady() covers them, so encoding overlaps with
+ *  processing instead of starting after it.
+ */
+class ProgressiveImage
+{
+public:
+    /** @brief  Constructor
+     *
+     *  @param  width   image width in pixels
+     *  @param  height  image height in pixels
+     *  @param  bands   number of bands
+     *  @param  like    image to copy sample format and interpretation from
+     */
+    ProgressiveImage(uint32_t width, uint32_t height, uint32_t bands, const vips::VImage& like);
+
+    //! Returns image to be passed to the encoder
+    vips::VImage Image() const;
+
+    //! Returns first pixel of a row to be filled
+    uint8_t* Row(uint32_t y);
+
+    //! Returns distance between rows in bytes
+    size_t Stride() const;
+
+    /** @brief  Lets the encoder read rows [0, rows)
+     *
+     *  @param  rows    number of complete rows from the top
+     */
+    void MarkRowsReady(uint32_t rows);
+
+    //! Makes encoder fail instead of waiting for rows that will never come
+    void Abort();
+
+private:
+    //! libvips generate callback, copies complete rows into the requested region
+    static int Generate(VipsRegion* region, void* sequence, void* self, void* unused, gboolean* stop);
+
+    //! Pixel data
+    std::vector<uint8_t> m_buffer;
+    size_t m_stride;
+    size_t m_pixelBytes;
+
+    //! Number of complete rows and whether the rest will ever come
+    std::mutex m_mutex;
+    std::condition_variable m_ready;
+    uint32_t m_readyRows;
+    bool m_aborted;
+
+    //! libvips image reading @p m_buffer
+    vips::VImage m_image;
+};
+
+#endif // ANINISCALE_PROGRESSIVE_IMAGE_HPP
@@ -0,0 +1,394 @@
+/*
+* Copyright (c) 2017 Dmitry Odintsov
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "Pyramid.hpp"
+
+#include "Profiler.hpp"
+#include "TaskGeometry.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+namespace
+{
+
+/** @brief  Majority color of a block, if it has one
+ *
+ *  Color has at least @p votes votes in the block, more than half of them
+ */
+struct Majority
+{
+    //! A pixel of majority color, null if no color is known to have more than half of the votes
+    const uint8_t* pixel;
+    uint32_t votes;
+};
+
+//! Output of a single level
+struct Level
+{
+    BlockShape shape;
+    DominantColorKernel kernel;
+    uint32_t decisive;
+
+    //! Top left pixel of the output and distance between its rows in bytes
+    uint8_t* out;
+    size_t outStride;
+};
+
+/** @brief  Compares colors of two pixels
+ *
+ *  @tparam Bytes   pixel size known at compile time, 0 to use @p pixelBytes
+ */
+template <uint32_t Bytes>
+inline bool SameColor(const uint8_t* a, const uint8_t* b, uint32_t pixelBytes)
+{
+    return 0 == memcmp(a, b, Bytes ? Bytes : pixelBytes);
+}
+
+/** @brief  Finds dominant color of a finest block and counts votes for it
+ *
+ *  Uniform blocks, the common case in flat areas, are told apart without
+ *  running the kernel.
+ *
+ *  @return majority, without a pixel if dominant color has no more than half of the votes
+ */
+template <uint32_t Bytes>
+Majority FinestMajority(const Level& level, const uint8_t* block, size_t stride, uint32_t pixelBytes,
+    ColorHistogram& colors, const uint8_t*& dominant)
+{
+    const BlockShape& shape = level.shape;
+    const uint32_t size = shape.x * shape.y;
+    uint32_t same = 0;
+
+    //! Pixels equal to the first one, counting stops at the first other color
+    for (uint32_t y = 0; y < shape.y && same == y * shape.x; ++y)
+    {
+        const uint8_t* row = block + y * stride;
+
+        for (uint32_t x = 0; x < shape.x && SameColor<Bytes>(row + x * pixelBytes, block, pixelBytes); ++x)
+        {
+            ++same;
+        }
+    }
+
+    Majority majority = { block, size };
+
+    if (same == size)
+    {
+        dominant = block;
+        return majority;
+    }
+
+    dominant = level.kernel(block, stride, shape, colors);
+
+    majority.pixel = dominant;
+    majority.votes = 0;
+
+    for (uint32_t y = 0; y < shape.y; ++y)
+    {
+        for (uint32_t x = 0; x < shape.x; ++x)
+        {
+            majority.votes += SameColor<Bytes>(block + y * stride + x * pixelBytes, dominant, pixelBytes);
+        }
+    }
+
+    if (majority.votes <= size / 2)
+    {
+        majority.pixel = 0;
+    }
+
+    return majority;
+}
+
+/** @brief  Merges majorities of child blocks into a lower bound for their parent
+ *
+ *  Only a color that has more than half of the votes in some child can
+ *  have more than half of them in the parent, its votes in children where
+ *  it is not the majority are not counted.
+ */
+template <uint32_t Bytes>
+Majority MergeMajority(const Majority* children, uint32_t x_parts, uint32_t y_parts, uint32_t childStride,
+    const BlockShape& shape, uint32_t pixelBytes)
+{
+    Majority majority = { 0, 0 };
+
+    for (uint32_t candidateY = 0; candidateY < y_parts; ++candidateY)
+    {
+        for (uint32_t candidateX = 0; candidateX < x_parts; ++candidateX)
+        {
+            const Majority& candidate = children[candidateY * childStride + candidateX];
+
+            if (!candidate.pixel)
+            {
+                continue;
+            }
+
+            uint32_t votes = 0;
+
+            for (uint32_t y = 0; y < y_parts; ++y)
+            {
+                for (uint32_t x = 0; x < x_parts; ++x)
+                {
+                    const Majority& child = children[y * childStride + x];
+
+                    if (child.pixel && SameColor<Bytes>(child.pixel, candidate.pixel, pixelBytes))
+                    {
+                        votes += child.votes;
+                    }
+                }
+            }
+
+            if (votes > majority.votes)
+            {
+                majority.pixel = candidate.pixel;
+                majority.votes = votes;
+            }
+        }
+    }
+
+    if (majority.votes <= shape.x * shape.y / 2)
+    {
+        majority.pixel = 0;
+    }
+
+    return majority;
+}
+
+/** @brief  Finds dominant colors of every level inside a single coarsest block
+ *
+ *  @tparam Bytes   pixel size known at compile time, 0 for any other size
+ *
+ *  @param  block   first pixel of the coarsest block
+ *  @param  x       coarsest block column
+ *  @param  y       coarsest block row
+ */
+template <uint32_t Bytes>
+void ReduceBlock(const std::vector<Level>& levels, const uint8_t* block, size_t stride, uint32_t x, uint32_t y,
+    ColorHistogram& colors)
+{
+    //! Majorities of every block of every level inside the coarsest block, row by row
+    static thread_local std::vector<std::vector<Majority>> majorities;
+    majorities.resize(levels.size());
+
+    const BlockShape& coarsest = levels.back().shape;
+    const uint32_t pixelBytes = Bytes ? Bytes : coarsest.bands * coarsest.sampleBytes;
+
+    for (uint32_t l = 0; l < levels.size(); ++l)
+    {
+        const Level& level = levels[l];
+
+        //! Number of blocks of this level inside the coarsest block and number of child blocks inside each of them
+        const uint32_t x_blocks = coarsest.x / level.shape.x;
+        const uint32_t y_blocks = coarsest.y / level.shape.y;
+        const uint32_t x_parts = l ? level.shape.x / levels[l - 1].shape.x : 0;
+        const uint32_t y_parts = l ? level.shape.y / levels[l - 1].shape.y : 0;
+
+        majorities[l].resize(x_blocks * y_blocks);
+
+        uint8_t* outRow = level.out + static_cast<size_t>(y) * y_blocks * level.outStride +
+            static_cast<size_t>(x) * x_blocks * pixelBytes;
+
+        for (uint32_t by = 0; by < y_blocks; ++by, outRow += level.outStride)
+        {
+            for (uint32_t bx = 0; bx < x_blocks; ++bx)
+            {
+                const uint8_t* first = block + by * level.shape.y * stride + bx * level.shape.x * pixelBytes;
+                Majority& majority = majorities[l][by * x_blocks + bx];
+
+                const uint8_t* dominant = 0;
+
+                //! Finest level counts pixels, the others merge counts of their child blocks
+                if (0 == l)
+                {
+                    majority = FinestMajority<Bytes>(level, first, stride, pixelBytes, colors, dominant);
+                }
+                else
+                {
+                    majority = MergeMajority<Bytes>(majorities[l - 1].data() + by * y_parts * x_blocks * x_parts + bx * x_parts,
+                        x_parts, y_parts, x_blocks * x_parts, level.shape, pixelBytes);
+
+                    dominant = majority.pixel && majority.votes >= level.decisive ? majority.pixel :
+                        level.kernel(first, stride, level.shape, colors);
+                }
+
+                memcpy(outRow + bx * pixelBytes, dominant, pixelBytes);
+            }
+        }
+    }
+}
+
+typedef void (*ReduceBlockRoutine)(const std::vector<Level>& levels, const uint8_t* block, size_t stride,
+    uint32_t x, uint32_t y, ColorHistogram& colors);
+
+//! Picks ReduceBlock() compiled for pixels of @p pixelBytes bytes
+ReduceBlockRoutine SelectReduceBlock(uint32_t pixelBytes)
+{
+    switch (pixelBytes)
+    {
+        case 1: return &ReduceBlock<1>;
+        case 2: return &ReduceBlock<2>;
+        case 3: return &ReduceBlock<3>;
+        case 4: return &ReduceBlock<4>;
+        case 6: return &ReduceBlock<6>;
+        case 8: return &ReduceBlock<8>;
+        default: return &ReduceBlock<0>;
+    }
+}
+
+} // namespace
+
+bool ParseBlockSizes(const std::string& list, std::vector<BlockSize>& sizes)
+{
+    sizes.clear();
+
+    std::istringstream stream(list);
+    std::string item;
+
+    while (std::getline(stream, item, ','))
+    {
+        char* end = 0;
+        const long x = strtol(item.c_str(), &end, 10);
+        long y = x;
+
+        if ('x' == *end || 'X' == *end)
+        {
+            y = strtol(end + 1, &end, 10);
+        }
+
+        if (*end || x < 1 || y < 1)
+        {
+            return false;
+        }
+
+        sizes.push_back(BlockSize(x, y));
+    }
+
+    std::sort(sizes.begin(), sizes.end(), [](const BlockSize& a, const BlockSize& b){
+        return static_cast<uint64_t>(a.first) * a.second < static_cast<uint64_t>(b.first) * b.second;
+    });
+
+    for (size_t i = 1; i < sizes.size(); ++i)
+    {
+        if (sizes[i] == sizes[i - 1] || sizes[i].first % sizes[i - 1].first || sizes[i].second % sizes[i - 1].second)
+        {
+            return false;
+        }
+    }
+
+    return !sizes.empty();
+}
+
+std::vector<DownscaledImage> DownscalePyramid(WorkerPool& pool, const uint8_t* pixels, size_t stride,
+    uint32_t width, uint32_t height, const std::vector<BlockShape>& shapes, uint32_t taskBlockSide)
+{
+    if (shapes.empty())
+    {
+        throw vips::VError("invalid pyramid levels");
+    }
+
+    for (size_t l = 0; l < shapes.size(); ++l)
+    {
+        const BlockShape& shape = shapes[l];
+
+        if (0 == shape.bands || 0 == shape.sampleBytes || 0 == shape.x || 0 == shape.y ||
+            shape.bands != shapes[0].bands || shape.sampleBytes != shapes[0].sampleBytes ||
+            (l > 0 && (shape.x % shapes[l - 1].x || shape.y % shapes[l - 1].y ||
+                (shape.x == shapes[l - 1].x && shape.y == shapes[l - 1].y))))
+        {
+            throw vips::VError("invalid pyramid levels");
+        }
+    }
+
+    const BlockShape& coarsest = shapes.back();
+    const BlockShape& finest = shapes.front();
+    const uint32_t pixelBytes = coarsest.bands * coarsest.sampleBytes;
+
+    const uint32_t x_coarse = width / coarsest.x;
+    const uint32_t y_coarse = height / coarsest.y;
+
+    if (0 == x_coarse || 0 == y_coarse)
+    {
+        throw vips::VError("image is smaller than a single block");
+    }
+
+    std::vector<DownscaledImage> results(shapes.size());
+    std::vector<Level> levels(shapes.size());
+
+    for (size_t l = 0; l < shapes.size(); ++l)
+    {
+        DownscaledImage& result = results[l];
+        result.width = width / shapes[l].x;
+        result.height = height / shapes[l].y;
+        result.bands = shapes[l].bands;
+        result.sampleBytes = shapes[l].sampleBytes;
+        result.pixels.resize(static_cast<size_t>(result.width) * result.height * pixelBytes);
+
+        levels[l].shape = shapes[l];
+        levels[l].kernel = SelectDominantColorKernel(shapes[l]);
+        levels[l].decisive = DecisiveVotes(shapes[l]);
+        levels[l].out = result.pixels.data();
+        levels[l].outStride = static_cast<size_t>(result.width) * pixelBytes;
+    }
+
+    const ReduceBlockRoutine reduceBlock = SelectReduceBlock(pixelBytes);
+
+    //! Tasks are made of whole coarsest blocks, taskBlockSide limits finest blocks along each side
+    const uint32_t ratio = std::max(coarsest.x / finest.x, coarsest.y / finest.y);
+    const TaskGeometry geometry = PlanTasks(coarsest, x_coarse, y_coarse, pool.WorkerCount(),
+        taskBlockSide ? std::max(1u, taskBlockSide / ratio) : 0);
+    const uint32_t x_taskCount = (x_coarse + geometry.x_blocks - 1) / geometry.x_blocks;
+    const uint32_t y_taskCount = (y_coarse + geometry.y_blocks - 1) / geometry.y_blocks;
+    const uint32_t areaTasks = x_taskCount * y_taskCount;
+
+    //! Finer levels may have blocks past the last whole coarsest block, one extra task per level covers them
+    pool.Run(areaTasks + static_cast<uint32_t>(shapes.size()), [&](WorkerPool& worker, uint32_t task){
+        static thread_local ColorHistogram colors;
+
+        if (task >= areaTasks)
+        {
+            const Level& level = levels[task - areaTasks];
+            const uint32_t x_edge = x_coarse * coarsest.x;
+            const uint32_t y_edge = y_coarse * coarsest.y;
+
+            //! Right edge of the whole height, then bottom edge under the coarsest blocks, each only if it holds a block
+            if (width - x_edge >= level.shape.x)
+            {
+                worker.ProcessArea(level.kernel, level.shape, pixels + x_edge * pixelBytes, stride,
+                    width - x_edge, height, level.out + x_edge / level.shape.x * pixelBytes, level.outStride);
+            }
+
+            if (height - y_edge >= level.shape.y)
+            {
+                worker.ProcessArea(level.kernel, level.shape, pixels + y_edge * stride, stride,
+                    x_edge, height - y_edge, level.out + y_edge / level.shape.y * level.outStride, level.outStride);
+            }
+
+            return;
+        }
+
+        const uint32_t x_first = (task % x_taskCount) * geometry.x_blocks;
+        const uint32_t y_first = (task / x_taskCount) * geometry.y_blocks;
+        const uint32_t x_count = std::min(geometry.x_blocks, x_coarse - x_first);
+        const uint32_t y_count = std::min(geometry.y_blocks, y_coarse - y_first);
+
+        ProfileSpan span("compute", true);
+
+        colors.Reserve(coarsest.x * coarsest.y);
+
+        for (uint32_t y = y_first; y < y_first + y_count; ++y)
+        {
+            for (uint32_t x = x_first; x < x_first + x_count; ++x)
+            {
+                reduceBlock(levels, pixels + static_cast<size_t>(y) * coarsest.y * stride +
+                    static_cast<size_t>(x) * coarsest.x * pixelBytes, stride, x, y, colors);
+            }
+        }
+    });
+
+    return results;
+}
@@ -0,0 +1,58 @@
+/*
+* Copyright (c) 2017 Dmitry Odintsov
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#ifndef ANINISCALE_PYRAMID_HPP
+#define ANINISCALE_PYRAMID_HPP
+
+#include "Aniniscale.hpp"
+#include "DominantColor.hpp"
+#include "WorkerPool.hpp"
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+//! Block size of a pyramid level, X then Y
+typedef std::pair<uint32_t, uint32_t> BlockSize;
+
+/** @brief  Parses comma separated list of block sizes, such as "2,4,8" or "2x2,4x8"
+ *
+ *  A single number stands for a square block
+ *
+ *  @return false if list is malformed or sizes are not nested: every size
+ *          shall be a multiple of the previous one on both axes
+ */
+bool ParseBlockSizes(const std::string& list, std::vector<BlockSize>& sizes);
+
+/** @brief  Downscales pixel buffer with several nested block sizes at once
+ *
+ *  Pixels are counted once, for dominant color of every finest block.
+ *  Votes for majority color of every coarser block are added up from the
+ *  blocks it consists of, and it is taken as dominant color whenever it
+ *  has DecisiveVotes(). Only the remaining blocks are scanned again by the
+ *  kernel, so every level is exactly what Downscale() would produce.
+ *
+ *  @attention  shall not be called from a task running on @p pool
+ *
+ *  @param  pool            workers to run on
+ *  @param  pixels          top left pixel of the image
+ *  @param  stride          distance between image rows in bytes
+ *  @param  width           image width in pixels
+ *  @param  height          image height in pixels
+ *  @param  levels          block shapes from the finest to the coarsest, with the same pixel layout,
+ *                          every block size a multiple of the previous one on both axes
+ *  @param  taskBlockSide   maximum number of finest blocks along each side of a task, 0 to pick automatically
+ *
+ *  @return one image per level, in @p levels order
+ *
+ *  @throws vips::VError if levels are not nested or image is smaller than the coarsest block
+ */
+std::vector<DownscaledImage> DownscalePyramid(WorkerPool& pool, const uint8_t* pixels, size_t stride,
+    uint32_t width, uint32_t height, const std::vector<BlockShape>& levels,
+    uint32_t taskBlockSide = s_defaultTaskBlockSide);
+
+#endif // ANINISCALE_PYRAMID_HPP
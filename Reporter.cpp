@@ -6,68 +6,156 @@
 
 #include "Reporter.hpp"
 
+#include <algorithm>
+#include <chrono>
 #include <ctime>
 #include <iostream>
 #include <iomanip>
+#include <sstream>
+#include <vector>
 
-static const std::time_t startTime = std::time(0);
-static volatile std::time_t progressReport = std::time(0);
+static const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
 
 uint32_t Reporter::s_minTimeout = 5;
-uint32_t Reporter::s_tasksTotal = 0;
-uint32_t Reporter::s_taskPixels = 0;
 
-void Reporter::ReportElapsedTime()
+namespace
+{
+
+//! Formats number of seconds as HH:MM:SS
+std::string FormatTime(double seconds)
 {
-    std::time_t elapsed = std::time(0) - startTime;
+    std::time_t time = static_cast<std::time_t>(seconds + 0.5);
 
     char buffer[9];
-    if (std::strftime(buffer, sizeof(buffer), "%H:%M:%S", std::gmtime(&elapsed)))
+    if (std::strftime(buffer, sizeof(buffer), "%H:%M:%S", std::gmtime(&time)))
     {
-        std::cout << "/" << std::setfill('-') << std::setw(25) << "\\" << std::endl;
-        std::cout << "| Time elapsed: " << buffer << " |" << std::endl;
-        std::cout << "\\" << std::setfill('-') << std::setw(25) << "/" << std::endl;
+        return buffer;
     }
-    else
+
+    return "??:??:??";
+}
+
+} // namespace
+
+std::vector<WorkerSnapshot> SnapshotStats(const WorkerStats* stats, uint32_t workerCount)
+{
+    std::vector<WorkerSnapshot> snapshot(workerCount);
+
+    for (uint32_t i = 0; i < workerCount; ++i)
     {
-        std::cout << "Failed to convert data ¯\\_(ツ)_/¯" << std::endl;
+        snapshot[i].blocks = stats[i].blocks.load(std::memory_order_relaxed);
+        snapshot[i].busy = stats[i].busy.load(std::memory_order_relaxed);
     }
+
+    return snapshot;
 }
 
-void Reporter::EstimateTimeLeft(uint32_t tasksLeft)
+void Reporter::ReportElapsedTime()
 {
-    std::time_t elapsed = std::time(0) - startTime;
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
 
-    double perSecond = ((double)(s_tasksTotal - tasksLeft)) / ((double)elapsed);
+    std::cout << "/" << std::setfill('-') << std::setw(25) << "\\" << std::endl;
+    std::cout << "| Time elapsed: " << FormatTime(elapsed) << " |" << std::endl;
+    std::cout << "\\" << std::setfill('-') << std::setw(25) << "/" << std::endl;
+}
 
-    std::time_t eta = static_cast<uint32_t>(((double)tasksLeft) / perSecond);
+Reporter::Reporter(const WorkerStats* stats, uint32_t workerCount, uint64_t totalBlocks, uint32_t blockPixels)
+    : m_stats(stats)
+    , m_workerCount(workerCount)
+    , m_baseline(SnapshotStats(stats, workerCount))
+    , m_totalBlocks(totalBlocks)
+    , m_blockPixels(blockPixels)
+    , m_stop(false)
+{
+    m_thread = std::thread(&Reporter::Run, this);
+}
 
-    char buffer[9];
-    if (std::strftime(buffer, sizeof(buffer), "%H:%M:%S", std::gmtime(&eta)))
+Reporter::~Reporter()
+{
     {
-        std::cout << "/" << std::setfill('-') << std::setw(16) << "\\" << std::endl;
-        std::cout << "| ETA: " << buffer << " |" << std::endl;
-        std::cout << "\\" << std::setfill('-') << std::setw(16) << "/" << std::endl;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
     }
-    else
+
+    m_wake.notify_one();
+    m_thread.join();
+}
+
+void Reporter::Run()
+{
+    typedef std::chrono::steady_clock Clock;
+
+    const Clock::time_point start = Clock::now();
+    Clock::time_point last = start;
+
+    std::vector<uint64_t> lastBusy(m_workerCount);
+
+    for (uint32_t i = 0; i < m_workerCount; ++i)
+    {
+        lastBusy[i] = m_baseline[i].busy;
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (!m_wake.wait_for(lock, std::chrono::seconds(s_minTimeout), [this]{ return m_stop; }))
     {
-        std::cout << "Failed to convert data ¯\\_(ツ)_/¯" << std::endl;
+        const Clock::time_point now = Clock::now();
+
+        ProgressReport(std::chrono::duration<double>(now - start).count(),
+            std::chrono::duration<double>(now - last).count(), lastBusy.data());
+
+        last = now;
     }
 }
 
-void Reporter::ProgressReport(uint32_t tasksLeft)
+void Reporter::ProgressReport(double elapsed, double interval, uint64_t* lastBusy)
 {
-    if (std::time(0) - progressReport < s_minTimeout)
+    uint64_t blocks = 0;
+
+    for (uint32_t i = 0; i < m_workerCount; ++i)
     {
-        return;
+        blocks += m_stats[i].blocks.load(std::memory_order_relaxed) - m_baseline[i].blocks;
     }
 
-    std::cout << std::endl;
+    //! Workers may serve other runs at the same time, as they do in server mode, so progress is capped
+    blocks = std::min(blocks, m_totalBlocks);
+
+    const double blocksPerSecond = elapsed > 0 ? blocks / elapsed : 0;
+    const double percent = m_totalBlocks ? 100.0 * blocks / m_totalBlocks : 100.0;
+
+    //! Build the whole report first, so it is written and flushed at once
+    std::ostringstream report;
+    report << std::fixed << std::setprecision(1);
+
+    report << "\nTime elapsed: " << FormatTime(elapsed)
+        << ", blocks: " << blocks << "/" << m_totalBlocks << " (" << percent << "%)\n";
+
+    report << "Throughput: " << blocksPerSecond * m_blockPixels / 1e6 << " Mpx/s, "
+        << blocksPerSecond / 1e3 << " Kblocks/s\n";
 
-    ReportElapsedTime();
-    EstimateTimeLeft(tasksLeft);
+    report << "ETA: ";
+
+    if (blocks > 0)
+    {
+        report << FormatTime((m_totalBlocks - blocks) / blocksPerSecond) << "\n";
+    }
+    else
+    {
+        report << "unknown, no blocks complete yet\n";
+    }
+
+    report << "Worker utilization:" << std::setprecision(0);
+
+    for (uint32_t i = 0; i < m_workerCount; ++i)
+    {
+        const uint64_t busy = m_stats[i].busy.load(std::memory_order_relaxed);
+        const double utilization = interval > 0 ? (busy - lastBusy[i]) / 1e9 / interval * 100.0 : 0;
+
+        report << " " << std::min(utilization, 100.0) << "%";
+        lastBusy[i] = busy;
+    }
 
-    progressReport = std::time(0);
+    report << "\n";
 
-    std::cout << "Tasks left: " << tasksLeft << " (" << tasksLeft * s_taskPixels << "px)" << std::endl;
+    std::cout << report.str() << std::flush;
 }
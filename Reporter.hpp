@@ -7,40 +7,92 @@
 #ifndef ANINISCALE_REPORTER_HPP
 #define ANINISCALE_REPORTER_HPP
 
+#include <atomic>
+#include <condition_variable>
 #include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
 
-/** @brief  Prints information regarding runtime to std::cout */
+//! Counters a single worker updates as it goes
+struct WorkerStats
+{
+    //! Number of blocks processed
+    std::atomic<uint64_t> blocks;
+
+    //! Time spent on tasks in nanoseconds
+    std::atomic<uint64_t> busy;
+
+    //! Keeps counters of different workers on different cache lines
+    char padding[64 - 2 * sizeof(std::atomic<uint64_t>)];
+};
+
+//! Counters of a worker at some point in time
+struct WorkerSnapshot
+{
+    uint64_t blocks;
+    uint64_t busy;
+};
+
+//! Returns counters of every worker
+std::vector<WorkerSnapshot> SnapshotStats(const WorkerStats* stats, uint32_t workerCount);
+
+/** @brief  Prints information regarding runtime to std::cout
+ *
+ *  Progress is printed from a dedicated thread that only reads worker
+ *  counters, so workers never wait for console output. Pools outlive
+ *  single runs, so only work done since the reporter was started counts.
+ */
 class Reporter
 {
 public:
-    //! Minimum timeout between ProgressReport() printouts
+    //! Minimum timeout between progress printouts in seconds
     static uint32_t s_minTimeout;
 
-    //! Total number of tasks
-    static uint32_t s_tasksTotal;
-
-    //! Number of pixels in one task
-    static uint32_t s_taskPixels;
-
-    //! Prints elapsed time
+    //! Prints time elapsed since program start
     static void ReportElapsedTime();
 
-    /** @brief  Prints ETA
-     *
-     *  Estimates how many time is required to finish remaining tasks
+    /** @brief  Starts reporting thread
      *
-     *  @param  tasksLeft   amount of remaining tasks
+     *  @param  stats       per-worker counters
+     *  @param  workerCount number of elements in @p stats
+     *  @param  totalBlocks number of blocks to be processed
+     *  @param  blockPixels number of pixels in one block
      */
-    static void EstimateTimeLeft(uint32_t tasksLeft);
+    Reporter(const WorkerStats* stats, uint32_t workerCount, uint64_t totalBlocks, uint32_t blockPixels);
 
-    /** @brief  Reports current progress
-     *
-     *  Calls ReportElapsedTime(), EstimateTimeLeft() and prints how many
-     *  tasks are left to be processed
+    //! Stops reporting thread
+    ~Reporter();
+
+private:
+    //! Reporting thread routine
+    void Run();
+
+    /** @brief  Prints current progress, throughput, worker utilization and ETA
      *
-     *  @param  tasksLeft   amount of remaining tasks
+     *  @param  elapsed     seconds since reporting started
+     *  @param  interval    seconds since previous report
+     *  @param  lastBusy    per-worker busy time at previous report, updated
      */
-    static void ProgressReport(uint32_t tasksLeft);
+    void ProgressReport(double elapsed, double interval, uint64_t* lastBusy);
+
+    //! Per-worker counters
+    const WorkerStats* m_stats;
+    uint32_t m_workerCount;
+
+    //! Counters when reporting started, left by earlier runs on the same workers
+    std::vector<WorkerSnapshot> m_baseline;
+
+    //! Amount of work
+    uint64_t m_totalBlocks;
+    uint32_t m_blockPixels;
+
+    //! Wakes reporting thread up when it has to stop
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    bool m_stop;
+
+    std::thread m_thread;
 };
 
 #endif // ANINISCALE_REPORTER_HPP
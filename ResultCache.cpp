@@ -0,0 +1,235 @@
+/*
+* Copyright (c) 2017 Dmitry Odintsov
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "ResultCache.hpp"
+
+#include "Hash.hpp"
+
+#include <vips/vips8>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+//! Shall be bumped whenever the same input and parameters start producing different output
+static const uint32_t s_cacheVersion = 3;
+
+//! Input file is hashed in chunks of this size
+static const size_t s_hashChunkBytes = 1 << 20;
+
+namespace
+{
+
+//! Copies file, replacing destination
+bool CopyFile(const std::string& from, const std::string& to)
+{
+    std::ifstream source(from.c_str(), std::ios::binary);
+
+    if (!source)
+    {
+        return false;
+    }
+
+    std::ofstream destination(to.c_str(), std::ios::binary | std::ios::trunc);
+
+    return destination && (destination << source.rdbuf()) && destination.flush();
+}
+
+//! Cache entry found on disk
+struct Entry
+{
+    std::string path;
+    uint64_t bytes;
+    time_t used;
+};
+
+/** @brief  Lists cache entries
+ *
+ *  Hidden files are entries being written and are skipped
+ */
+std::vector<Entry> ListEntries(const std::string& directory)
+{
+    std::vector<Entry> entries;
+    DIR* dir = opendir(directory.c_str());
+
+    if (!dir)
+    {
+        return entries;
+    }
+
+    while (dirent* item = readdir(dir))
+    {
+        struct stat info;
+        Entry entry;
+        entry.path = directory + "/" + item->d_name;
+
+        if (item->d_name[0] != '.' && 0 == stat(entry.path.c_str(), &info) && S_ISREG(info.st_mode))
+        {
+            entry.bytes = info.st_size;
+            entry.used = info.st_mtime;
+            entries.push_back(entry);
+        }
+    }
+
+    closedir(dir);
+
+    return entries;
+}
+
+} // namespace
+
+ResultCache::ResultCache(const std::string& directory, uint64_t maxBytes)
+    : m_directory(directory)
+    , m_maxBytes(maxBytes)
+    , m_bytes(0)
+    , m_hits(0)
+    , m_misses(0)
+{
+    struct stat info;
+    const bool exists = 0 == stat(directory.c_str(), &info);
+
+    if (exists ? !S_ISDIR(info.st_mode) : 0 != mkdir(directory.c_str(), 0755))
+    {
+        throw vips::VError("unable to create cache directory " + directory);
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Trim();
+}
+
+std::string ResultCache::Key(const std::string& in, uint32_t x_blockSize, uint32_t y_blockSize,
+    const EncoderOptions& options, bool allFrames) const
+{
+    std::ifstream source(in.c_str(), std::ios::binary);
+    std::vector<char> chunk(s_hashChunkBytes);
+    uint64_t content = 0;
+
+    while (source)
+    {
+        source.read(chunk.data(), chunk.size());
+        content = HashBytes(chunk.data(), source.gcount(), content);
+    }
+
+    if (!source.eof())
+    {
+        throw vips::VError("unable to read " + in);
+    }
+
+    const uint32_t parameters[] = {
+        s_cacheVersion,
+        x_blockSize,
+        y_blockSize,
+        static_cast<uint32_t>(options.format),
+        static_cast<uint32_t>(options.compression),
+        static_cast<uint32_t>(options.pngFilter),
+        static_cast<uint32_t>(options.palette),
+        static_cast<uint32_t>(allFrames),
+    };
+
+    char key[40];
+    snprintf(key, sizeof(key), "%016llx%016llx", static_cast<unsigned long long>(content),
+        static_cast<unsigned long long>(HashBytes(parameters, sizeof(parameters))));
+
+    return key + std::string(OutputFormatExtension(options.format));
+}
+
+bool ResultCache::Fetch(const std::string& key, const std::string& out)
+{
+    const std::string path = Path(key);
+
+    if (!CopyFile(path, out))
+    {
+        ++m_misses;
+        return false;
+    }
+
+    //! Modification time doubles as time of last use
+    utime(path.c_str(), 0);
+
+    ++m_hits;
+
+    return true;
+}
+
+bool ResultCache::Store(const std::string& key, const std::string& out)
+{
+    static std::atomic<uint32_t> s_counter(0);
+
+    //! Written under a hidden name first, so nobody sees a partial entry
+    std::ostringstream temporary;
+    temporary << m_directory << "/." << key << "-" << getpid() << "-" << s_counter++;
+
+    struct stat info;
+
+    if (!CopyFile(out, temporary.str()) || 0 != stat(temporary.str().c_str(), &info) ||
+        0 != rename(temporary.str().c_str(), Path(key).c_str()))
+    {
+        unlink(temporary.str().c_str());
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_bytes += info.st_size;
+
+    if (m_bytes > m_maxBytes)
+    {
+        Trim();
+    }
+
+    return true;
+}
+
+uint64_t ResultCache::Hits() const
+{
+    return m_hits;
+}
+
+uint64_t ResultCache::Misses() const
+{
+    return m_misses;
+}
+
+std::string ResultCache::Path(const std::string& key) const
+{
+    return m_directory + "/" + key;
+}
+
+void ResultCache::Trim()
+{
+    //! Other processes may use the same directory, so it is the only source of truth
+    std::vector<Entry> entries = ListEntries(m_directory);
+
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b){
+        return a.used < b.used;
+    });
+
+    m_bytes = 0;
+
+    for (const Entry& entry : entries)
+    {
+        m_bytes += entry.bytes;
+    }
+
+    for (const Entry& entry : entries)
+    {
+        if (m_bytes <= m_maxBytes)
+        {
+            break;
+        }
+
+        if (0 == unlink(entry.path.c_str()))
+        {
+            m_bytes -= entry.bytes;
+        }
+    }
+}
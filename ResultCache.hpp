@@ -0,0 +1,81 @@
+/*
+* Copyright (c) 2017 Dmitry Odintsov
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#ifndef ANINISCALE_RESULT_CACHE_HPP
+#define ANINISCALE_RESULT_CACHE_HPP
+
+#include "Encoder.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+/** @brief  On-disk cache of encoded results
+ *
+ *  Entries are named by a hash of the input file bytes together with every
+ *  parameter that affects the output, so a hit needs neither decoding nor
+ *  processing. Least recently used entries are removed once total size of
+ *  the cache exceeds the limit. Directory may be shared by several processes.
+ *
+ *  Safe to use from several threads at once.
+ */
+class ResultCache
+{
+public:
+    /** @brief  Constructor
+     *
+     *  @param  directory   cache directory, created if missing
+     *  @param  maxBytes    total size entries are trimmed to
+     *
+     *  @throws vips::VError if directory can't be created
+     */
+    ResultCache(const std::string& directory, uint64_t maxBytes);
+
+    /** @brief  Computes entry key of a result
+     *
+     *  @param  in          input file, read as a whole
+     *  @param  allFrames   whether result holds every frame of multi-page input or just the first one
+     *
+     *  @throws vips::VError if input file can't be read
+     */
+    std::string Key(const std::string& in, uint32_t x_blockSize, uint32_t y_blockSize,
+        const EncoderOptions& options, bool allFrames) const;
+
+    /** @brief  Copies cached result to @p out, counting a hit or a miss
+     *
+     *  @return false if there is no entry for @p key
+     */
+    bool Fetch(const std::string& key, const std::string& out);
+
+    /** @brief  Adds result saved at @p out under @p key, trimming the cache if needed
+     *
+     *  @return false if result could not be stored, that is not an error for the caller
+     */
+    bool Store(const std::string& key, const std::string& out);
+
+    uint64_t Hits() const;
+    uint64_t Misses() const;
+
+private:
+    //! Returns path of entry file
+    std::string Path(const std::string& key) const;
+
+    //! Removes least recently used entries until total size fits, m_mutex shall be held
+    void Trim();
+
+    std::string m_directory;
+    uint64_t m_maxBytes;
+
+    //! Total size of entries, recounted from directory on every trim
+    std::mutex m_mutex;
+    uint64_t m_bytes;
+
+    std::atomic<uint64_t> m_hits;
+    std::atomic<uint64_t> m_misses;
+};
+
+#endif // ANINISCALE_RESULT_CACHE_HPP
@@ -0,0 +1,625 @@
+/*
+* Copyright (c) 2017 Dmitry Odintsov
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "Server.hpp"
+
+#include "Aniniscale.hpp"
+#include "Encoder.hpp"
+#include "MemoryBudget.hpp"
+
+#include <vips/vips8>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+
+namespace
+{
+
+//! Set by SIGINT and SIGTERM, server stops once it notices
+volatile std::sig_atomic_t s_interrupted = 0;
+
+void Interrupt(int)
+{
+    s_interrupted = 1;
+}
+
+//! Reads and writes lines and raw bytes over a connected socket
+class Connection
+{
+public:
+    explicit Connection(int fd)
+        : m_fd(fd)
+    {
+
+    }
+
+    /** @brief  Reads next line, without line break
+     *
+     *  @return false if connection was closed
+     */
+    bool ReadLine(std::string& line)
+    {
+        while (true)
+        {
+            const size_t end = m_buffer.find('\n');
+
+            if (end != std::string::npos)
+            {
+                line = m_buffer.substr(0, end);
+                m_buffer.erase(0, end + 1);
+
+                return true;
+            }
+
+            char chunk[4096];
+            const ssize_t received = recv(m_fd, chunk, sizeof(chunk), 0);
+
+            if (received < 0 && errno == EINTR)
+            {
+                continue;
+            }
+
+            if (received <= 0)
+            {
+                return false;
+            }
+
+            m_buffer.append(chunk, received);
+        }
+    }
+
+    /** @brief  Reads exactly @p size bytes
+     *
+     *  @return false if connection was closed
+     */
+    bool Read(uint8_t* data, size_t size)
+    {
+        //! Some of the bytes may have arrived together with the last line
+        const size_t buffered = std::min(size, m_buffer.size());
+        memcpy(data, m_buffer.data(), buffered);
+        m_buffer.erase(0, buffered);
+
+        for (size_t done = buffered; done < size; )
+        {
+            const ssize_t received = recv(m_fd, data + done, size - done, 0);
+
+            if (received < 0 && errno == EINTR)
+            {
+                continue;
+            }
+
+            if (received <= 0)
+            {
+                return false;
+            }
+
+            done += received;
+        }
+
+        return true;
+    }
+
+    /** @brief  Writes all of @p size bytes
+     *
+     *  @return false if connection was closed
+     */
+    bool Write(const void* data, size_t size)
+    {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+
+        for (size_t done = 0; done < size; )
+        {
+            //! Peer that went away shall not kill the whole process with SIGPIPE
+            const ssize_t sent = send(m_fd, bytes + done, size - done, MSG_NOSIGNAL);
+
+            if (sent < 0 && errno == EINTR)
+            {
+                continue;
+            }
+
+            if (sent <= 0)
+            {
+                return false;
+            }
+
+            done += sent;
+        }
+
+        return true;
+    }
+
+    bool WriteLine(std::string line)
+    {
+        line += '\n';
+
+        return Write(line.data(), line.size());
+    }
+
+private:
+    int m_fd;
+
+    //! Bytes received but not consumed yet
+    std::string m_buffer;
+};
+
+//! Mapping of a POSIX shared memory object
+class SharedMemory
+{
+public:
+    /** @brief  Creates a new object or opens existing one
+     *
+     *  Object created here is removed again by destructor
+     *
+     *  @param  name    object name, starting with a slash
+     *  @param  size    size in bytes, existing object must be at least that big
+     *  @param  create  whether to create a writable object or open existing one read-only
+     *
+     *  @throws vips::VError if object can't be created, opened or mapped
+     */
+    SharedMemory(const std::string& name, size_t size, bool create)
+        : m_name(name)
+        , m_data(MAP_FAILED)
+        , m_size(size)
+        , m_owner(create)
+    {
+        const int fd = create ? shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600) : shm_open(name.c_str(), O_RDONLY, 0);
+
+        if (fd < 0)
+        {
+            throw vips::VError("unable to open shared memory " + name + ": " + strerror(errno));
+        }
+
+        struct stat info;
+        bool sized = create ? 0 == ftruncate(fd, size) : (0 == fstat(fd, &info) && static_cast<size_t>(info.st_size) >= size);
+
+        if (sized && size > 0)
+        {
+            m_data = mmap(0, size, create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+        }
+
+        close(fd);
+
+        if (!sized || (size > 0 && m_data == MAP_FAILED))
+        {
+            if (m_owner)
+            {
+                shm_unlink(name.c_str());
+            }
+
+            throw vips::VError("unable to map shared memory " + name + ", it may be smaller than the image");
+        }
+    }
+
+    ~SharedMemory()
+    {
+        if (m_data != MAP_FAILED)
+        {
+            munmap(m_data, m_size);
+        }
+
+        if (m_owner)
+        {
+            shm_unlink(m_name.c_str());
+        }
+    }
+
+    uint8_t* Data() const
+    {
+        return static_cast<uint8_t*>(m_data);
+    }
+
+private:
+    std::string m_name;
+    void* m_data;
+    size_t m_size;
+    bool m_owner;
+};
+
+//! Splits line into tab separated fields
+std::vector<std::string> SplitFields(const std::string& line)
+{
+    std::vector<std::string> fields;
+    std::istringstream stream(line);
+    std::string field;
+
+    while (std::getline(stream, field, '\t'))
+    {
+        fields.push_back(field);
+    }
+
+    return fields;
+}
+
+/** @brief  Parses positive integer request field
+ *
+ *  @throws vips::VError if field is not a positive integer
+ */
+uint32_t ParseField(const std::string& field)
+{
+    const int value = atoi(field.c_str());
+
+    if (value < 1)
+    {
+        throw vips::VError("expected a positive integer, got '" + field + "'");
+    }
+
+    return value;
+}
+
+/** @brief  Opens socket listening on @p path or connected to it
+ *
+ *  @return socket descriptor or -1 with errno set
+ */
+int OpenSocket(const std::string& path, bool listen)
+{
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+
+    if (path.size() >= sizeof(address.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    if (listen)
+    {
+        //! Socket left behind by a server that was killed would make bind fail
+        unlink(path.c_str());
+
+        if (0 == bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) && 0 == ::listen(fd, SOMAXCONN))
+        {
+            return fd;
+        }
+    }
+    else if (0 == connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)))
+    {
+        return fd;
+    }
+
+    const int error = errno;
+    close(fd);
+    errno = error;
+
+    return -1;
+}
+
+/** @brief  Carries out a single request and sends the reply
+ *
+ *  @return false if connection was lost
+ */
+bool HandleRequest(WorkerPool& pool, const Arguments& arguments, ResultCache* cache, Connection& connection,
+    const std::string& line)
+{
+    const std::vector<std::string> fields = SplitFields(line);
+
+    try
+    {
+        if (fields.size() == 5 && fields[0] == "file")
+        {
+            //! Server's own encoder options apply to every request
+            Arguments request = arguments;
+            request.x_blockSize = ParseField(fields[1]);
+            request.y_blockSize = ParseField(fields[2]);
+            request.in = fields[3];
+            request.out = fields[4];
+
+            std::string key;
+
+            if (cache && FetchCached(*cache, request, key))
+            {
+                return connection.WriteLine("ok");
+            }
+
+            vips::VImage img = vips::VImage::new_from_file( request.in.c_str() );
+            WarnFirstFrame(img, request.in);
+
+            if (request.x_blockSize == 1 && request.y_blockSize == 1)
+            {
+                SaveUnchanged(img, request.in, request.out, request.Encoding());
+            }
+            else
+            {
+                //! Concurrent requests wait while others use the memory up
+                BudgetReservation reservation(pool.Memory(),
+                    static_cast<uint64_t>(img.width()) * img.height() * img.bands() * vips_format_sizeof(img.format()));
+
+                SaveImage(Downscale(pool, img, request.x_blockSize, request.y_blockSize, arguments.taskBlockSide),
+                    request.out, request.Encoding());
+            }
+
+            if (!key.empty())
+            {
+                cache->Store(key, request.out);
+            }
+
+            return connection.WriteLine("ok");
+        }
+
+        if (fields.size() == 8 && fields[0] == "shm")
+        {
+            BlockShape shape;
+            shape.x = ParseField(fields[1]);
+            shape.y = ParseField(fields[2]);
+            shape.bands = ParseField(fields[6]);
+            shape.sampleBytes = ParseField(fields[7]);
+
+            const uint32_t width = ParseField(fields[4]);
+            const uint32_t height = ParseField(fields[5]);
+            const size_t stride = static_cast<size_t>(width) * shape.bands * shape.sampleBytes;
+
+            BudgetReservation reservation(pool.Memory(), stride * height);
+            SharedMemory input(fields[3], stride * height, false);
+
+            const DownscaledImage result = Downscale(pool, input.Data(), stride, width, height, shape,
+                arguments.taskBlockSide);
+
+            std::ostringstream reply;
+            reply << "ok\t" << result.width << "\t" << result.height << "\t" << result.bands << "\t"
+                << result.sampleBytes << "\t" << result.pixels.size();
+
+            return connection.WriteLine(reply.str()) && connection.Write(result.pixels.data(), result.pixels.size());
+        }
+
+        throw vips::VError("malformed request");
+    }
+    catch( vips::VError& e )
+    {
+        //! Reply is a single line
+        std::string message = e.what();
+        std::replace(message.begin(), message.end(), '\n', ' ');
+
+        return connection.WriteLine("error\t" + message);
+    }
+}
+
+//! Makes relative path absolute, server may run in another directory
+std::string AbsolutePath(const std::string& path)
+{
+    if (path.empty() || path[0] == '/')
+    {
+        return path;
+    }
+
+    char cwd[4096];
+
+    return getcwd(cwd, sizeof(cwd)) ? std::string(cwd) + "/" + path : path;
+}
+
+} // namespace
+
+int Serve(WorkerPool& pool, const Arguments& arguments, ResultCache* cache)
+{
+    const int listener = OpenSocket(arguments.serve, true);
+
+    if (listener < 0)
+    {
+        std::cout << "Error occured while opening socket " << arguments.serve.c_str() << std::endl;
+        std::cerr << strerror(errno) << std::endl;
+        return -1;
+    }
+
+    s_interrupted = 0;
+    std::signal(SIGINT, &Interrupt);
+    std::signal(SIGTERM, &Interrupt);
+
+    std::cout << "Serving on " << arguments.serve.c_str() << ", interrupt to stop" << std::endl;
+
+    //! Open connections, so they can be shut down once server stops
+    std::mutex mutex;
+    std::condition_variable idle;
+    std::vector<int> connections;
+
+    while (!s_interrupted)
+    {
+        //! Wake up every now and then in case the signal came in between checks
+        pollfd pending = { listener, POLLIN, 0 };
+
+        if (poll(&pending, 1, 1000) <= 0)
+        {
+            continue;
+        }
+
+        const int fd = accept(listener, 0, 0);
+
+        if (fd < 0)
+        {
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        connections.push_back(fd);
+
+        std::thread([&, fd]{
+            Connection connection(fd);
+            std::string line;
+
+            while (connection.ReadLine(line) && HandleRequest(pool, arguments, cache, connection, line))
+            {
+
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+
+            connections.erase(std::find(connections.begin(), connections.end(), fd));
+            close(fd);
+
+            //! Notified under the lock, Serve() may return as soon as it is released
+            idle.notify_all();
+        }).detach();
+    }
+
+    std::cout << "Stopping server" << std::endl;
+
+    close(listener);
+    unlink(arguments.serve.c_str());
+
+    std::signal(SIGINT, SIG_DFL);
+    std::signal(SIGTERM, SIG_DFL);
+
+    //! Requests in progress are completed, connections are closed once their replies are sent
+    std::unique_lock<std::mutex> lock(mutex);
+
+    for (int fd : connections)
+    {
+        shutdown(fd, SHUT_RD);
+    }
+
+    idle.wait(lock, [&]{ return connections.empty(); });
+
+    return 0;
+}
+
+int RunClient(const Arguments& arguments)
+{
+    const int fd = OpenSocket(arguments.connect, false);
+
+    if (fd < 0)
+    {
+        std::cout << "Error occured while connecting to " << arguments.connect.c_str() << std::endl;
+        std::cerr << strerror(errno) << std::endl;
+        return -1;
+    }
+
+    Connection connection(fd);
+    std::string reply;
+    int retVal = 0;
+
+    try
+    {
+        if (!arguments.shm)
+        {
+            std::ostringstream request;
+            request << "file\t" << arguments.x_blockSize << "\t" << arguments.y_blockSize << "\t"
+                << AbsolutePath(arguments.in) << "\t" << AbsolutePath(arguments.out);
+
+            if (!connection.WriteLine(request.str()) || !connection.ReadLine(reply))
+            {
+                throw vips::VError("connection closed by server");
+            }
+        }
+        else
+        {
+            vips::VImage img = vips::VImage::new_from_file( arguments.in.c_str() );
+            WarnFirstFrame(img, arguments.in);
+            const uint8_t* pixels = reinterpret_cast<const uint8_t*>(img.data());
+
+            if (!pixels)
+            {
+                throw vips::VError();
+            }
+
+            const uint32_t sampleBytes = vips_format_sizeof(img.format());
+            const size_t size = static_cast<size_t>(img.width()) * img.height() * img.bands() * sampleBytes;
+
+            std::ostringstream name;
+            name << "/aniniscale-" << getpid();
+
+            SharedMemory input(name.str(), size, true);
+            memcpy(input.Data(), pixels, size);
+
+            std::ostringstream request;
+            request << "shm\t" << arguments.x_blockSize << "\t" << arguments.y_blockSize << "\t" << name.str() << "\t"
+                << img.width() << "\t" << img.height() << "\t" << img.bands() << "\t" << sampleBytes;
+
+            if (!connection.WriteLine(request.str()) || !connection.ReadLine(reply))
+            {
+                throw vips::VError("connection closed by server");
+            }
+
+            const std::vector<std::string> fields = SplitFields(reply);
+
+            if (fields.empty())
+            {
+                throw vips::VError("malformed reply");
+            }
+
+            if (fields[0] == "ok")
+            {
+                if (fields.size() != 6)
+                {
+                    throw vips::VError("malformed reply");
+                }
+
+                std::vector<uint8_t> result(strtoull(fields[5].c_str(), 0, 10));
+
+                if (!connection.Read(result.data(), result.size()))
+                {
+                    throw vips::VError("connection closed by server");
+                }
+
+                vips::VImage outImg = vips::VImage::new_from_memory(result.data(), result.size(),
+                    ParseField(fields[1]), ParseField(fields[2]), ParseField(fields[3]), img.format());
+
+                SaveImage(outImg, arguments.out, arguments.Encoding());
+            }
+        }
+
+        if (reply.compare(0, 2, "ok") != 0)
+        {
+            std::cout << "Server failed to process image " << arguments.in.c_str() << std::endl;
+            std::cerr << reply.substr(reply.find('\t') + 1) << std::endl;
+            retVal = -1;
+        }
+    }
+    catch( vips::VError& e )
+    {
+        std::cout << "Error occured while processing image " << arguments.in.c_str() << std::endl;
+        std::cerr << e.what() << std::endl;
+        retVal = -1;
+    }
+
+    close(fd);
+
+    return retVal;
+}
+
+#else
+
+int Serve(WorkerPool&, const Arguments&, ResultCache*)
+{
+    std::cout << "Server mode is not supported on this platform" << std::endl;
+    return -1;
+}
+
+int RunClient(const Arguments&)
+{
+    std::cout << "Server mode is not supported on this platform" << std::endl;
+    return -1;
+}
+
+#endif
@@ -0,0 +1,50 @@
+/*
+* Copyright (c) 2017 Dmitry Odintsov
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#ifndef ANINISCALE_SERVER_HPP
+#define ANINISCALE_SERVER_HPP
+
+#include "Process.hpp"
+#include "WorkerPool.hpp"
+
+/** @brief  Serves downscaling requests over a Unix domain socket until interrupted
+ *
+ *  Every connection is handled by a thread of its own and may send any
+ *  number of requests, one per line, fields separated by tabs:
+ *
+ *      file    X   Y   INPUT   OUTPUT
+ *          Downscales image file INPUT to OUTPUT, format is picked by
+ *          OUTPUT extension. Replies with "ok" line.
+ *
+ *      shm     X   Y   NAME    WIDTH   HEIGHT  BANDS   SAMPLE_BYTES
+ *          Downscales packed pixels in POSIX shared memory object NAME.
+ *          Replies with "ok WIDTH HEIGHT BANDS SAMPLE_BYTES SIZE" line
+ *          followed by SIZE bytes of packed resulting pixels.
+ *
+ *  Failed requests are answered with "error MESSAGE" line. Small images are
+ *  processed on the connection's own thread, bigger ones share @p pool.
+ *
+ *  @param  pool        workers shared by every request
+ *  @param  arguments   arguments.serve is socket path, task block side applies to every request
+ *  @param  cache       results of file requests, may be null
+ *
+ *  @return 0 once interrupted, error is printed otherwise
+ */
+int Serve(WorkerPool& pool, const Arguments& arguments, ResultCache* cache = 0);
+
+/** @brief  Sends a single request to a running server and waits for the result
+ *
+ *  With arguments.shm set, input is decoded here and handed over in shared
+ *  memory, result comes back over the socket and is saved here. Otherwise
+ *  server reads and writes the files itself.
+ *
+ *  @param  arguments   arguments.connect is socket path
+ *
+ *  @return 0 on success, error is printed otherwise
+ */
+int RunClient(const Arguments& arguments);
+
+#endif // ANINISCALE_SERVER_HPP
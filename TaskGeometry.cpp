@@ -0,0 +1,303 @@
+/*
+* Copyright (c) 2017 Dmitry Odintsov
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "TaskGeometry.hpp"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+//! Assumed when cache size can't be detected
+static const size_t s_defaultCacheBytes = 256 << 10;
+
+//! Every worker gets at least this many tasks, so stealing can even out their speeds
+static const uint64_t s_tasksPerWorker = 4;
+
+//! Smaller tasks spend more time on being handed out than on processing
+static const uint64_t s_minTaskPixels = 1 << 14;
+
+//! Every candidate geometry is timed this many times, the fastest run counts
+static const uint32_t s_tuneRepeats = 3;
+
+namespace
+{
+
+//! Reads cache size from libc, falling back to sysfs
+size_t DetectCacheBytes()
+{
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    const long bytes = sysconf(_SC_LEVEL2_CACHE_SIZE);
+
+    if (bytes > 0)
+    {
+        return bytes;
+    }
+#endif
+
+    //! Second level cache is the third index, after L1 data and instruction caches
+    std::ifstream file("/sys/devices/system/cpu/cpu0/cache/index2/size");
+    size_t size = 0;
+    char unit = 0;
+
+    if (file >> size && size > 0)
+    {
+        file >> unit;
+        return size << (unit == 'K' ? 10 : unit == 'M' ? 20 : 0);
+    }
+
+    return s_defaultCacheBytes;
+}
+
+//! Returns number of blocks processed in about the time it takes to hand a task out
+uint64_t MinTaskBlocks(const BlockShape& shape)
+{
+    return std::max<uint64_t>(1, s_minTaskPixels / (static_cast<uint64_t>(shape.x) * shape.y));
+}
+
+/** @brief  Lays @p area blocks out as a task: whole block rows if they fit, the rest in height
+ *
+ *  Sides are then evened out, so edge tasks are not much smaller than the others
+ */
+TaskGeometry Shape(uint64_t area, uint32_t x_tiles, uint32_t y_tiles, uint32_t maxSide)
+{
+    area = std::max<uint64_t>(1, area);
+
+    TaskGeometry geometry;
+    geometry.x_blocks = static_cast<uint32_t>(std::min<uint64_t>(std::min(x_tiles, maxSide), area));
+    geometry.y_blocks = static_cast<uint32_t>(std::max<uint64_t>(1,
+        std::min<uint64_t>(std::min(y_tiles, maxSide), area / geometry.x_blocks)));
+
+    const uint32_t x_taskCount = (x_tiles + geometry.x_blocks - 1) / geometry.x_blocks;
+    const uint32_t y_taskCount = (y_tiles + geometry.y_blocks - 1) / geometry.y_blocks;
+
+    geometry.x_blocks = (x_tiles + x_taskCount - 1) / x_taskCount;
+    geometry.y_blocks = (y_tiles + y_taskCount - 1) / y_taskCount;
+
+    return geometry;
+}
+
+} // namespace
+
+size_t TaskCacheBytes()
+{
+    static const size_t s_cacheBytes = DetectCacheBytes();
+
+    return s_cacheBytes;
+}
+
+uint64_t TaskBlockLimit(const BlockShape& shape, uint32_t taskBlockSide)
+{
+    if (taskBlockSide)
+    {
+        return static_cast<uint64_t>(taskBlockSide) * taskBlockSide;
+    }
+
+    //! Half of the cache is left for output, vote counters and whatever else runs on the core
+    const uint64_t blockBytes = static_cast<uint64_t>(shape.x) * shape.y * shape.bands * shape.sampleBytes;
+
+    return std::max(MinTaskBlocks(shape), TaskCacheBytes() / 2 / std::max<uint64_t>(1, blockBytes));
+}
+
+TaskGeometry PlanTasks(const BlockShape& shape, uint32_t x_tiles, uint32_t y_tiles,
+    uint32_t workerCount, uint32_t taskBlockSide, uint32_t frameCount)
+{
+    const uint64_t totalBlocks = static_cast<uint64_t>(x_tiles) * y_tiles * std::max(1u, frameCount);
+    const uint64_t balanced = totalBlocks / (std::max(1u, workerCount) * s_tasksPerWorker);
+
+    uint64_t area = std::min(TaskBlockLimit(shape, taskBlockSide), balanced);
+
+    //! Splitting finer than MinTaskBlocks() doesn't pay off, unless task side is limited explicitly
+    if (0 == taskBlockSide)
+    {
+        area = std::max(area, MinTaskBlocks(shape));
+    }
+
+    return Shape(area, x_tiles, y_tiles, taskBlockSide ? taskBlockSide : UINT32_MAX);
+}
+
+void ProcessTasks(WorkerPool& pool, DominantColorKernel kernel, const BlockShape& shape,
+    const uint8_t* pixels, size_t stride, uint32_t x_tiles, uint32_t y_tiles,
+    uint8_t* out, size_t outStride, const TaskGeometry& geometry,
+    uint32_t frameCount, size_t frameBytes, size_t outFrameBytes)
+{
+    const uint32_t pixelBytes = shape.bands * shape.sampleBytes;
+    const uint32_t x_taskCount = (x_tiles + geometry.x_blocks - 1) / geometry.x_blocks;
+    const uint32_t y_taskCount = (y_tiles + geometry.y_blocks - 1) / geometry.y_blocks;
+    const uint32_t frameTasks = x_taskCount * y_taskCount;
+
+    pool.Run(frameTasks * frameCount, [&](WorkerPool& worker, uint32_t task){
+        const uint32_t frame = task / frameTasks;
+        const uint32_t x_first = (task % frameTasks % x_taskCount) * geometry.x_blocks;
+        const uint32_t y_first = (task % frameTasks / x_taskCount) * geometry.y_blocks;
+        const uint32_t x_count = std::min(geometry.x_blocks, x_tiles - x_first);
+        const uint32_t y_count = std::min(geometry.y_blocks, y_tiles - y_first);
+
+        worker.ProcessArea(kernel, shape,
+            pixels + frame * frameBytes +
+                static_cast<size_t>(y_first) * shape.y * stride + static_cast<size_t>(x_first) * shape.x * pixelBytes,
+            stride, x_count * shape.x, y_count * shape.y,
+            out + frame * outFrameBytes + y_first * outStride + x_first * pixelBytes, outStride);
+    });
+}
+
+TaskGeometry TuneTasks(WorkerPool& pool, DominantColorKernel kernel, const BlockShape& shape,
+    const uint8_t* pixels, size_t stride, uint32_t width, uint32_t height)
+{
+    typedef std::chrono::steady_clock Clock;
+
+    const uint32_t x_tiles = width / shape.x;
+    const uint32_t y_tiles = height / shape.y;
+    const uint32_t pixelBytes = shape.bands * shape.sampleBytes;
+    const uint32_t workerCount = pool.WorkerCount();
+
+    const TaskGeometry planned = PlanTasks(shape, x_tiles, y_tiles, workerCount, 0);
+    const uint64_t area = static_cast<uint64_t>(planned.x_blocks) * planned.y_blocks;
+    const uint32_t square = std::max(1u, static_cast<uint32_t>(std::sqrt(static_cast<double>(area))));
+
+    //! Planned geometry, a quarter and four times its size, and a square task of the same size
+    std::vector<TaskGeometry> candidates;
+    candidates.push_back(planned);
+    candidates.push_back(Shape(area / 4, x_tiles, y_tiles, UINT32_MAX));
+    candidates.push_back(Shape(area * 4, x_tiles, y_tiles, UINT32_MAX));
+    candidates.push_back(Shape(area, x_tiles, y_tiles, square));
+
+    //! Sample has enough block rows for several tasks of the biggest candidate per worker, up to a quarter of the image
+    uint32_t sampleRows = 1;
+
+    for (const TaskGeometry& candidate : candidates)
+    {
+        const uint64_t x_taskCount = (x_tiles + candidate.x_blocks - 1) / candidate.x_blocks;
+        const uint64_t taskRows = (workerCount * s_tasksPerWorker + x_taskCount - 1) / x_taskCount;
+
+        sampleRows = static_cast<uint32_t>(std::max<uint64_t>(sampleRows, taskRows * candidate.y_blocks));
+    }
+
+    sampleRows = std::max(1u, std::min(sampleRows, y_tiles / 4));
+
+    const uint8_t* sample = pixels + static_cast<size_t>((y_tiles - sampleRows) / 2) * shape.y * stride;
+    const size_t outStride = static_cast<size_t>(x_tiles) * pixelBytes;
+    std::vector<uint8_t> out(outStride * sampleRows);
+
+    //! Pages of the sample and the output are touched once before anything is timed
+    ProcessTasks(pool, kernel, shape, sample, stride, x_tiles, sampleRows, out.data(), outStride, planned);
+
+    TaskGeometry best = planned;
+    double bestSeconds = -1;
+
+    for (const TaskGeometry& candidate : candidates)
+    {
+        //! Tasks taller than the sample would be timed on a sample of a different shape
+        if (candidate.y_blocks > sampleRows)
+        {
+            continue;
+        }
+
+        for (uint32_t repeat = 0; repeat < s_tuneRepeats; ++repeat)
+        {
+            const Clock::time_point start = Clock::now();
+            ProcessTasks(pool, kernel, shape, sample, stride, x_tiles, sampleRows, out.data(), outStride, candidate);
+            const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+            if (bestSeconds < 0 || seconds < bestSeconds)
+            {
+                best = candidate;
+                bestSeconds = seconds;
+            }
+        }
+    }
+
+    return best;
+}
+
+std::string TaskGeometryKey(const BlockShape& shape, uint32_t width, uint32_t height, uint32_t workerCount)
+{
+    std::ostringstream key;
+    key << width << "x" << height << "-" << shape.bands << "x" << shape.sampleBytes << "-"
+        << shape.x << "x" << shape.y << "-" << workerCount;
+
+    return key.str();
+}
+
+bool LoadTunedGeometry(const std::string& path, const std::string& key, TaskGeometry& geometry)
+{
+    std::ifstream file(path.c_str());
+    std::string line;
+
+    //! One geometry per line: key, blocks along X, blocks along Y
+    while (std::getline(file, line))
+    {
+        std::istringstream fields(line);
+        std::string lineKey;
+        TaskGeometry lineGeometry;
+
+        if (fields >> lineKey >> lineGeometry.x_blocks >> lineGeometry.y_blocks && lineKey == key &&
+            lineGeometry.x_blocks > 0 && lineGeometry.y_blocks > 0)
+        {
+            geometry = lineGeometry;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool SaveTunedGeometry(const std::string& path, const std::string& key, const TaskGeometry& geometry)
+{
+    std::vector<std::string> lines;
+
+    {
+        std::ifstream file(path.c_str());
+        std::string line;
+
+        while (std::getline(file, line))
+        {
+            std::istringstream fields(line);
+            std::string lineKey;
+
+            if (fields >> lineKey && lineKey != key)
+            {
+                lines.push_back(line);
+            }
+        }
+    }
+
+    std::ostringstream line;
+    line << key << " " << geometry.x_blocks << " " << geometry.y_blocks;
+    lines.push_back(line.str());
+
+    //! Written aside and renamed, so a concurrent run never reads half of the file
+    std::ostringstream temporary;
+    temporary << path << "." << getpid();
+
+    {
+        std::ofstream file(temporary.str().c_str(), std::ios::trunc);
+
+        for (const std::string& item : lines)
+        {
+            file << item << "\n";
+        }
+
+        if (!file.flush())
+        {
+            unlink(temporary.str().c_str());
+            return false;
+        }
+    }
+
+    if (0 != rename(temporary.str().c_str(), path.c_str()))
+    {
+        unlink(temporary.str().c_str());
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,101 @@
+/*
+* Copyright (c) 2017 Dmitry Odintsov
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#ifndef ANINISCALE_TASK_GEOMETRY_HPP
+#define ANINISCALE_TASK_GEOMETRY_HPP
+
+#include "DominantColor.hpp"
+#include "WorkerPool.hpp"
+
+#include <cstdint>
+#include <string>
+
+//! Number of blocks along each side of a task, tasks at the right and bottom edges may be smaller
+struct TaskGeometry
+{
+    uint32_t x_blocks;
+    uint32_t y_blocks;
+};
+
+//! Returns size of per-core cache tasks are fitted into, in bytes
+size_t TaskCacheBytes();
+
+/** @brief  Returns maximum number of blocks in a task
+ *
+ *  @param  taskBlockSide   maximum number of blocks along each side of a task,
+ *                          0 to fit task input into TaskCacheBytes()
+ */
+uint64_t TaskBlockLimit(const BlockShape& shape, uint32_t taskBlockSide);
+
+/** @brief  Picks how image of @p x_tiles x @p y_tiles blocks is split into tasks
+ *
+ *  Tasks are as big as TaskBlockLimit() allows, but small enough to give every
+ *  worker a few of them to balance, and never so small that handing them out
+ *  costs more than processing. They span as many blocks along X as possible,
+ *  so every task reads long runs of consecutive pixels.
+ *
+ *  Tasks never span several frames, so frames of @p frameCount are balanced
+ *  as a whole: small frames make a task each and are processed in parallel.
+ *
+ *  @param  y_tiles         number of block rows in a frame
+ *  @param  workerCount     number of workers tasks are spread over, any positive number
+ *  @param  taskBlockSide   maximum number of blocks along each side of a task, 0 to pick automatically
+ *  @param  frameCount      number of frames of the image
+ */
+TaskGeometry PlanTasks(const BlockShape& shape, uint32_t x_tiles, uint32_t y_tiles,
+    uint32_t workerCount, uint32_t taskBlockSide, uint32_t frameCount = 1);
+
+/** @brief  Processes area of an image already loaded to memory, split into tasks of @p geometry
+ *
+ *  Frames of multi-page images are one more dimension of tasks, consecutive
+ *  tasks belong to the same frame.
+ *
+ *  @attention  shall not be called from a task running on @p pool
+ *
+ *  @param  pixels          top left pixel of the area
+ *  @param  stride          distance between area rows in bytes
+ *  @param  x_tiles         number of blocks in the area along X axis
+ *  @param  y_tiles         number of blocks in the area along Y axis, in a frame
+ *  @param  out             top left pixel of the output area
+ *  @param  outStride       distance between output rows in bytes
+ *  @param  frameCount      number of frames stacked one under another
+ *  @param  frameBytes      distance between the first rows of consecutive frames in bytes
+ *  @param  outFrameBytes   distance between the first rows of consecutive output frames in bytes
+ */
+void ProcessTasks(WorkerPool& pool, DominantColorKernel kernel, const BlockShape& shape,
+    const uint8_t* pixels, size_t stride, uint32_t x_tiles, uint32_t y_tiles,
+    uint8_t* out, size_t outStride, const TaskGeometry& geometry,
+    uint32_t frameCount = 1, size_t frameBytes = 0, size_t outFrameBytes = 0);
+
+/** @brief  Times a few geometries around PlanTasks() on a sample of the image and returns the fastest
+ *
+ *  Sample is a band of whole block rows in the middle of the image, big enough
+ *  to give every worker several tasks of each candidate.
+ *
+ *  @attention  shall not be called from a task running on @p pool
+ *
+ *  @param  pixels  top left pixel of the image
+ *  @param  stride  distance between image rows in bytes
+ */
+TaskGeometry TuneTasks(WorkerPool& pool, DominantColorKernel kernel, const BlockShape& shape,
+    const uint8_t* pixels, size_t stride, uint32_t width, uint32_t height);
+
+//! Returns key tuned geometry is remembered under: image size, pixel layout, block size and worker count
+std::string TaskGeometryKey(const BlockShape& shape, uint32_t width, uint32_t height, uint32_t workerCount);
+
+/** @brief  Looks geometry tuned earlier up in a file written by SaveTunedGeometry()
+ *
+ *  @return false if file is missing or has no geometry for @p key
+ */
+bool LoadTunedGeometry(const std::string& path, const std::string& key, TaskGeometry& geometry);
+
+/** @brief  Adds geometry to the file, replacing one remembered under the same key
+ *
+ *  @return false if file can't be written
+ */
+bool SaveTunedGeometry(const std::string& path, const std::string& key, const TaskGeometry& geometry);
+
+#endif // ANINISCALE_TASK_GEOMETRY_HPP
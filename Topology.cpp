@@ -0,0 +1,175 @@
+/*
+* Copyright (c) 2017 Dmitry Odintsov
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include "Topology.hpp"
+
+#include <dirent.h>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+//! Where the kernel describes NUMA nodes
+static const char* s_nodeDirectory = "/sys/devices/system/node";
+
+namespace
+{
+
+/** @brief  Parses CPU list such as "0-7,16-23"
+ *
+ *  @return false if list is malformed
+ */
+bool ParseCpuList(const std::string& list, std::vector<uint32_t>& cpus)
+{
+    std::istringstream stream(list);
+    std::string item;
+
+    while (std::getline(stream, item, ','))
+    {
+        unsigned first = 0;
+        unsigned last = 0;
+        char dash = 0;
+        std::istringstream range(item);
+
+        if (!(range >> first))
+        {
+            return false;
+        }
+
+        last = (range >> dash >> last && dash == '-') ? last : first;
+
+        for (unsigned cpu = first; cpu <= last; ++cpu)
+        {
+            cpus.push_back(cpu);
+        }
+    }
+
+    return true;
+}
+
+//! Returns CPUs this process may run on
+std::vector<uint32_t> AllowedCpus()
+{
+    std::vector<uint32_t> cpus;
+
+#ifdef __linux__
+    cpu_set_t set;
+
+    if (0 == sched_getaffinity(0, sizeof(set), &set))
+    {
+        for (uint32_t cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        {
+            if (CPU_ISSET(cpu, &set))
+            {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+#endif
+
+    if (cpus.empty())
+    {
+        for (uint32_t cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); ++cpu)
+        {
+            cpus.push_back(cpu);
+        }
+    }
+
+    return cpus;
+}
+
+} // namespace
+
+std::vector<NumaNode> DetectNumaNodes()
+{
+    const std::vector<uint32_t> allowed = AllowedCpus();
+    std::vector<NumaNode> nodes;
+
+    if (DIR* dir = opendir(s_nodeDirectory))
+    {
+        while (dirent* item = readdir(dir))
+        {
+            char* end = 0;
+
+            if (0 != strncmp(item->d_name, "node", 4) || !isdigit(item->d_name[4]))
+            {
+                continue;
+            }
+
+            NumaNode node;
+            node.id = strtoul(item->d_name + 4, &end, 10);
+
+            std::ifstream file((std::string(s_nodeDirectory) + "/" + item->d_name + "/cpulist").c_str());
+            std::string list;
+            std::vector<uint32_t> cpus;
+
+            if (*end || !std::getline(file, list) || !ParseCpuList(list, cpus))
+            {
+                continue;
+            }
+
+            //! Only CPUs we may run on count, nodes with memory only are left out
+            for (uint32_t cpu : cpus)
+            {
+                if (std::binary_search(allowed.begin(), allowed.end(), cpu))
+                {
+                    node.cpus.push_back(cpu);
+                }
+            }
+
+            if (!node.cpus.empty())
+            {
+                std::sort(node.cpus.begin(), node.cpus.end());
+                nodes.push_back(node);
+            }
+        }
+
+        closedir(dir);
+    }
+
+    if (nodes.empty())
+    {
+        NumaNode node;
+        node.id = 0;
+        node.cpus = allowed;
+        nodes.push_back(node);
+    }
+
+    std::sort(nodes.begin(), nodes.end(), [](const NumaNode& a, const NumaNode& b){
+        return a.id < b.id;
+    });
+
+    return nodes;
+}
+
+bool PinThread(uint32_t cpu)
+{
+#ifdef __linux__
+    if (cpu >= CPU_SETSIZE)
+    {
+        return false;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    return 0 == pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)cpu;
+    return false;
+#endif
+}
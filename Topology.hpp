@@ -0,0 +1,36 @@
+/*
+* Copyright (c) 2017 Dmitry Odintsov
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#ifndef ANINISCALE_TOPOLOGY_HPP
+#define ANINISCALE_TOPOLOGY_HPP
+
+#include <cstdint>
+#include <vector>
+
+//! Memory node and the CPUs close to it
+struct NumaNode
+{
+    //! Node number as the system knows it
+    uint32_t id;
+
+    //! CPUs this process may run on, in ascending order
+    std::vector<uint32_t> cpus;
+};
+
+/** @brief  Lists NUMA nodes that have CPUs this process may run on
+ *
+ *  Read from sysfs, so no NUMA library is needed. Systems without NUMA
+ *  information are reported as a single node with every allowed CPU.
+ */
+std::vector<NumaNode> DetectNumaNodes();
+
+/** @brief  Pins calling thread to a single CPU
+ *
+ *  @return false if pinning is not supported or CPU is not available
+ */
+bool PinThread(uint32_t cpu);
+
+#endif // ANINISCALE_TOPOLOGY_HPP
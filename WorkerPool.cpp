@@ -5,116 +5,446 @@
 */
 
 #include "WorkerPool.hpp"
-#include "Reporter.hpp"
 
-#include <map>
+#include "Profiler.hpp"
+#include "Topology.hpp"
 
-WorkerPool::WorkerPool(uint32_t bandCount, uint32_t x_blockSize, uint32_t y_blockSize)
-    : m_bandCount(bandCount)
-    , m_x_blockSize(x_blockSize)
-    , m_y_blockSize(y_blockSize)
+#include <chrono>
+#include <cstring>
+#include <sstream>
+
+namespace
+{
+
+uint64_t PackRange(uint64_t begin, uint64_t end)
+{
+    return (begin << 32) | end;
+}
+
+uint32_t RangeBegin(uint64_t bounds)
+{
+    return static_cast<uint32_t>(bounds >> 32);
+}
+
+uint32_t RangeEnd(uint64_t bounds)
+{
+    return static_cast<uint32_t>(bounds);
+}
+
+//! Counters of the worker running on current thread
+thread_local WorkerStats* t_stats = 0;
+
+/** @brief  Checks whether every pixel of an area has the color of its first pixel
+ *
+ *  First row is compared to itself shifted by a pixel, which holds only if
+ *  every pixel repeats the one before it, the other rows are compared to the
+ *  first one. Either way it is a plain memcmp over whole rows, vectorized by
+ *  the C library, and it stops at the first difference.
+ *
+ *  @param  rowBytes    area width in bytes, a row of one pixel or none is uniform
+ *  @param  rows        area height in pixels
+ */
+bool IsUniform(const uint8_t* area, size_t stride, size_t rowBytes, uint32_t rows, uint32_t pixelBytes)
+{
+    //! Row of at most one pixel can't differ from itself
+    if (rowBytes > pixelBytes && 0 != memcmp(area + pixelBytes, area, rowBytes - pixelBytes))
+    {
+        return false;
+    }
+
+    for (uint32_t y = 1; y < rows; ++y)
+    {
+        if (0 != memcmp(area + y * stride, area, rowBytes))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+} // namespace
+
+WorkerPool::WorkerPool(uint32_t workerCount, bool pin)
+    : m_ranges(new Range[workerCount])
+    , m_generation(0)
+    , m_runStart(0)
+    , m_busy(0)
+    , m_stop(false)
+    , m_stats(new WorkerStats[workerCount])
+    , m_workerNodes(workerCount, 0)
+    , m_workerCpus(workerCount, -1)
+    , m_nodeIds(1, 0)
+{
+    for (uint32_t i = 0; i < workerCount; ++i)
+    {
+        m_ranges[i].bounds = 0;
+        m_stats[i].blocks = 0;
+        m_stats[i].busy = 0;
+    }
+
+    if (pin)
+    {
+        const std::vector<NumaNode> nodes = DetectNumaNodes();
+        uint64_t totalCpus = 0;
+
+        for (const NumaNode& node : nodes)
+        {
+            totalCpus += node.cpus.size();
+        }
+
+        m_nodeIds.clear();
+
+        //! Every node gets its share of consecutive workers, CPUs of a node are taken in turn
+        uint64_t cpusBefore = 0;
+
+        for (const NumaNode& node : nodes)
+        {
+            const uint32_t first = workerCount * cpusBefore / totalCpus;
+            cpusBefore += node.cpus.size();
+            const uint32_t end = workerCount * cpusBefore / totalCpus;
+
+            if (first == end)
+            {
+                continue;
+            }
+
+            for (uint32_t i = first; i < end; ++i)
+            {
+                m_workerNodes[i] = m_nodeIds.size();
+                m_workerCpus[i] = node.cpus[(i - first) % node.cpus.size()];
+            }
+
+            m_nodeIds.push_back(node.id);
+        }
+    }
+
+    m_workers.reserve(workerCount);
+
+    for (uint32_t i = 0; i < workerCount; ++i)
+    {
+        m_workers.push_back(std::thread(&WorkerPool::Worker, this, i));
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+
+    m_wake.notify_all();
+
+    for (std::thread& worker : m_workers)
+    {
+        worker.join();
+    }
+}
+
+void WorkerPool::Run(uint32_t taskCount, Task task)
+{
+    if (0 == taskCount)
+    {
+        return;
+    }
+
+    //! Runs requested from different threads take turns
+    std::lock_guard<std::mutex> run(m_runMutex);
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    const uint64_t scheduleStart = Profiler::Enabled() ? Profiler::Now() : 0;
+
+    m_task = task;
+
+    //! Every worker starts with an equal share, the rest is balanced by stealing
+    const uint64_t workerCount = m_workers.size();
+
+    for (uint64_t i = 0; i < workerCount; ++i)
+    {
+        m_ranges[i].bounds = PackRange(taskCount * i / workerCount, taskCount * (i + 1) / workerCount);
+    }
+
+    m_busy = workerCount;
+    ++m_generation;
+
+    if (Profiler::Enabled())
+    {
+        m_runStart = Profiler::Now();
+        Profiler::Record("schedule", scheduleStart, m_runStart);
+    }
+
+    m_wake.notify_all();
+    m_done.wait(lock, [this]{ return 0 == m_busy; });
+
+    m_task = Task();
+}
+
+uint32_t WorkerPool::WorkerCount() const
+{
+    return m_workers.size();
+}
+
+const WorkerStats* WorkerPool::Stats() const
+{
+    return m_stats.get();
+}
+
+uint32_t WorkerPool::NodeCount() const
+{
+    return m_nodeIds.size();
+}
+
+uint32_t WorkerPool::WorkerNode(uint32_t worker) const
+{
+    return m_workerNodes[worker];
+}
+
+uint32_t WorkerPool::NodeId(uint32_t node) const
 {
+    return m_nodeIds[node];
+}
+
+void WorkerPool::LimitMemory(uint64_t bytes)
+{
+    m_memory.reset(new MemoryBudget(bytes));
+}
 
+MemoryBudget* WorkerPool::Memory() const
+{
+    return m_memory.get();
 }
 
-void WorkerPool::Worker()
+void WorkerPool::Worker(uint32_t id)
 {
+    uint32_t generation = 0;
+    t_stats = &m_stats[id];
+
+    //! Pages this worker touches first are then allocated on its node
+    if (m_workerCpus[id] >= 0)
+    {
+        PinThread(m_workerCpus[id]);
+    }
+
+    std::ostringstream name;
+    name << "worker " << id;
+    Profiler::NameThread(name.str());
+
     std::unique_lock<std::mutex> lock(m_mutex);
 
-    while (!m_tasks.empty())
+    while (true)
     {
-        //! Before you start working - report current time status
-        Reporter::ProgressReport(m_tasks.size());
+        //! Wait for a new run
+        m_wake.wait(lock, [&]{ return m_stop || m_generation != generation; });
 
-        //! Take a task
-        Task task = m_tasks.front();
-        m_tasks.pop_front();
+        if (m_stop)
+        {
+            return;
+        }
 
-        //! Let other workers take tasks as well
+        generation = m_generation;
+
+        //! Time between the run being published and the first task of this worker is spent in the queue
+        uint64_t waitStart = m_runStart;
+
+        //! Let other workers start as well
         lock.unlock();
 
-        //! Complete your task
-        task(*this);
+        uint32_t index = 0;
+
+        while (TakeTask(id, index) || StealTask(id, index))
+        {
+            const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+            if (Profiler::Enabled() && waitStart)
+            {
+                Profiler::Record("queue wait", waitStart, Profiler::Now());
+                waitStart = 0;
+            }
+
+            //! Complete your task
+            {
+                ProfileSpan span("task");
+                m_task(*this, index);
+            }
+
+            //! Account the time spent, reporter picks it up on its own
+            const std::chrono::nanoseconds busy = std::chrono::steady_clock::now() - start;
+            t_stats->busy.fetch_add(busy.count(), std::memory_order_relaxed);
+        }
 
         //! Rinse and repeat
         lock.lock();
+
+        if (0 == --m_busy)
+        {
+            m_done.notify_one();
+        }
     }
 }
 
-void WorkerPool::ProcessImage(vips::VImage img, std::vector<uint8_t>& out)
+bool WorkerPool::TakeTask(uint32_t id, uint32_t& index)
 {
-    //! Get image dimensions
-    const uint32_t width = img.width();
-    const uint32_t height = img.height();
-
-    //! Calculate tile count (== pixels in the end result)
-    const uint32_t x_tiles = width / m_x_blockSize;
-    const uint32_t y_tiles = height / m_y_blockSize;
+    std::atomic<uint64_t>& bounds = m_ranges[id].bounds;
+    uint64_t current = bounds.load();
 
-    //! Calculate size of each tile
-    const uint32_t size = m_x_blockSize * m_y_blockSize;
+    while (RangeBegin(current) < RangeEnd(current))
+    {
+        if (bounds.compare_exchange_weak(current, PackRange(RangeBegin(current) + 1, RangeEnd(current))))
+        {
+            index = RangeBegin(current);
+            return true;
+        }
+    }
 
-    //! Calculate color threshold - if color has this much, it is dominating
-    const uint32_t win = size / 2;
+    return false;
+}
 
-    //! Get image pixel data
-    const uint8_t* imgPixels = reinterpret_cast<const uint8_t*>(img.data());
+bool WorkerPool::StealTask(uint32_t id, uint32_t& index)
+{
+    //! Victims on the same node are tried first, so tasks stay close to memory their node touched
+    bool sameNode = NodeCount() > 1;
 
-    //! Iterate over all tiles
-    for (uint32_t x = 0; x < x_tiles; ++x)
+    while (true)
     {
-        for (uint32_t y = 0; y < y_tiles; ++y)
+        //! Pick the victim with the most work left
+        uint32_t victim = id;
+        uint64_t current = 0;
+        uint32_t left = 0;
+
+        for (uint32_t i = 0; i < m_workers.size(); ++i)
         {
-            //! Find dominant color
-            // @TODO: there must be some better way to do this. Histograms?
-            std::map<uint32_t, uint32_t> colors;
-            const uint8_t* dominant = 0;
-            uint32_t domCount = 0;
-
-            //! Iterate over all pixels in original area
-            for (uint32_t areaX = 0; areaX < m_x_blockSize; ++areaX)
+            const uint64_t bounds = m_ranges[i].bounds.load();
+
+            if (i != id && RangeEnd(bounds) - RangeBegin(bounds) > left &&
+                (!sameNode || m_workerNodes[i] == m_workerNodes[id]))
             {
-                for (uint32_t areaY = 0; areaY < m_y_blockSize; ++areaY)
-                {
-                    // Get current pixel data
-                    const uint8_t* pixel = imgPixels + (
-                        (areaY + y * m_y_blockSize) * width + areaX + x * m_x_blockSize
-                    ) * m_bandCount;
-
-                    uint32_t color = 0;
-
-                    //! Get color value
-                    for (uint32_t b = 0; b < m_bandCount; ++b)
-                    {
-                        color |= pixel[b] << ((m_bandCount - 1 - b) * 8);
-                    }
-
-                    //! Increase the number of votes for that color and check if it's dominating
-                    colors[color] += 1;
-
-                    if (domCount < colors[color])
-                    {
-                        domCount = colors[color];
-                        dominant = pixel;
-
-                        if (domCount >= win)
-                        {
-                            break;
-                        }
-                    }
-                }
+                victim = i;
+                current = bounds;
+                left = RangeEnd(bounds) - RangeBegin(bounds);
             }
+        }
 
-            //! Paint the resulting pixel with dominant color
-            for (uint32_t b = 0; b < m_bandCount; ++b)
+        if (victim == id)
+        {
+            if (sameNode)
             {
-                out[(y * x_tiles + x) * m_bandCount + b] = *(dominant + b);
+                sameNode = false;
+                continue;
             }
+
+            return false;
+        }
+
+        //! Split the range, victim keeps the lower half
+        const uint32_t begin = RangeBegin(current);
+        const uint32_t end = RangeEnd(current);
+        const uint32_t middle = begin + (end - begin) / 2;
+
+        if (m_ranges[victim].bounds.compare_exchange_strong(current, PackRange(begin, middle)))
+        {
+            index = middle;
+            m_ranges[id].bounds = PackRange(middle + 1, end);
+
+            return true;
         }
     }
 }
 
-void WorkerPool::PushTask(Task task)
+void WorkerPool::ProcessImage(DominantColorKernel kernel, const BlockShape& shape,
+    vips::VImage img, uint8_t* out, size_t outStride)
 {
-    m_tasks.push_back(task);
+    const size_t stride = static_cast<size_t>(img.width()) * shape.bands * shape.sampleBytes;
+
+    //! With memory limited, pixels go to a buffer borrowed from the budget instead of one libvips allocates
+    if (m_memory)
+    {
+        const size_t size = stride * img.height();
+        PooledBuffer buffer(*m_memory, size);
+
+        {
+            ProfileSpan span("materialize");
+            img.write(vips::VImage::new_from_memory(buffer.Data(), size,
+                img.width(), img.height(), shape.bands, img.format()));
+        }
+
+        ProcessArea(kernel, shape, buffer.Data(), stride, img.width(), img.height(), out, outStride);
+        return;
+    }
+
+    //! Get image pixel data
+    const uint8_t* imgPixels = 0;
+
+    {
+        ProfileSpan span("materialize");
+        imgPixels = reinterpret_cast<const uint8_t*>(img.data());
+    }
+
+    if (!imgPixels)
+    {
+        throw vips::VError();
+    }
+
+    ProcessArea(kernel, shape, imgPixels, stride, img.width(), img.height(), out, outStride);
+}
+
+void WorkerPool::ProcessArea(DominantColorKernel kernel, const BlockShape& shape,
+    const uint8_t* pixels, size_t stride, uint32_t width, uint32_t height,
+    uint8_t* out, size_t outStride)
+{
+    //! Calculate tile count (== pixels in the end result)
+    const uint32_t x_tiles = width / shape.x;
+    const uint32_t y_tiles = height / shape.y;
+
+    //! Area narrower or lower than a block has nothing to vote on
+    if (0 == x_tiles || 0 == y_tiles)
+    {
+        return;
+    }
+
+    //! Samples are copied as they are, whatever their type
+    const uint32_t pixelBytes = shape.bands * shape.sampleBytes;
+
+    ProfileSpan span("compute", true);
+
+    //! Vote counter is reused by every block this worker processes
+    static thread_local ColorHistogram colors;
+    colors.Reserve(shape.x * shape.y);
+
+    const size_t blockBytes = static_cast<size_t>(shape.x) * pixelBytes;
+
+    //! Iterate over all tiles, one row of blocks at a time so its source rows stay in cache
+    for (uint32_t y = 0; y < y_tiles; ++y)
+    {
+        const uint8_t* blockRow = pixels + y * shape.y * stride;
+        uint8_t* outRow = out + y * outStride;
+
+        //! Flat areas are common in upscaled pixel art, a row of blocks of a single color needs no voting at all
+        if (IsUniform(blockRow, stride, x_tiles * blockBytes, shape.y, pixelBytes))
+        {
+            for (uint32_t x = 0; x < x_tiles; ++x)
+            {
+                memcpy(outRow + x * pixelBytes, blockRow, pixelBytes);
+            }
+
+            continue;
+        }
+
+        for (uint32_t x = 0; x < x_tiles; ++x)
+        {
+            const uint8_t* block = blockRow + x * blockBytes;
+
+            //! Find dominant color, only blocks of several colors are voted on
+            const uint8_t* dominant = IsUniform(block, stride, blockBytes, shape.y, pixelBytes) ? block :
+                kernel(block, stride, shape, colors);
+
+            //! Paint the resulting pixel with dominant color
+            memcpy(outRow + x * pixelBytes, dominant, pixelBytes);
+        }
+    }
+
+    if (t_stats)
+    {
+        t_stats->blocks.fetch_add(x_tiles * y_tiles, std::memory_order_relaxed);
+    }
 }
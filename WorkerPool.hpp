@@ -8,55 +8,192 @@
 #define ANINISCALE_WORKER_POOL_HPP
 
 #include "WorkerPool.hpp"
+#include "DominantColor.hpp"
+#include "MemoryBudget.hpp"
+#include "Reporter.hpp"
 
 #include <vips/vips8>
 
+#include <atomic>
+#include <condition_variable>
 #include <functional>
-#include <list>
+#include <memory>
 #include <mutex>
+#include <thread>
 #include <vector>
 
 //! Described pool of thread workers
 class WorkerPool
 {
 public:
-    //! Shortcut to worker's routine task type
-    typedef std::function<void(WorkerPool&)> Task;
+    //! Shortcut to worker's routine task type, task is identified by its index
+    typedef std::function<void(WorkerPool&, uint32_t)> Task;
 
-    WorkerPool(uint32_t bandCount, uint32_t x_blockSize, uint32_t y_blockSize);
+    /** @brief  Constructor, spawns workers
+     *
+     *  Pinned workers are spread over NUMA nodes in proportion to their CPU
+     *  counts, workers of the same node get consecutive ids and each one is
+     *  pinned to a single CPU of its node.
+     *
+     *  @param  workerCount number of worker threads
+     *  @param  pin         pin workers to CPUs, node by node
+     */
+    explicit WorkerPool(uint32_t workerCount, bool pin = false);
 
-    //! Worker's routine
-    void Worker();
+    //! Destructor, stops workers
+    ~WorkerPool();
 
-    /** @brief  Process portion of an image
+    /** @brief  Runs a task for every index in [0, taskCount)
+     *
+     *  Indices are handed to workers as contiguous ranges, nothing is
+     *  allocated per task. A worker that runs out of indices steals the
+     *  upper half of the biggest range left, on its own node first.
      *
-     *  @param[in]  img image to process
-     *  @param[out] out buffer to store processing results
+     *  As workers of a node have consecutive ids, every node starts with a
+     *  contiguous share of indices, so tasks numbered row by row give each
+     *  node its own band of the image.
+     *
+     *  Returns once every task is complete. Runs requested from several
+     *  threads at once are carried out one after another.
+     *
+     *  @attention  this method shall not be called from a task
+     *
+     *  @param  taskCount   number of tasks
+     *  @param  task        routine performing a task with given index
      */
-    void ProcessImage(vips::VImage img, std::vector<uint8_t>& out);
+    void Run(uint32_t taskCount, Task task);
+
+    //! Returns number of worker threads
+    uint32_t WorkerCount() const;
+
+    //! Returns per-worker counters, one for each worker thread
+    const WorkerStats* Stats() const;
+
+    //! Returns number of NUMA nodes workers are spread over, 1 unless pinned
+    uint32_t NodeCount() const;
 
-    /** @brief  Pushes task to queue
+    //! Returns index of the node worker is pinned to, from 0 to NodeCount() - 1
+    uint32_t WorkerNode(uint32_t worker) const;
+
+    //! Returns system id of the node with given index
+    uint32_t NodeId(uint32_t node) const;
+
+    /** @brief  Limits memory held by images and task buffers of every run
+     *
+     *  @attention  shall be called before the first run
      *
-     *  @attention  this method is not thread safe and shall be called
-     *              before any worker is initialized
+     *  @param  bytes   maximum number of bytes in use at once
+     */
+    void LimitMemory(uint64_t bytes);
+
+    //! Returns budget images and task buffers are accounted in, null if memory is not limited
+    MemoryBudget* Memory() const;
+
+    /** @brief  Process portion of an image
+     *
+     *  If memory is limited, pixels are loaded to a buffer borrowed from the
+     *  budget, so the worker waits while the budget is used up.
+     *
+     *  @param[in]  kernel      routine that finds dominant color of a block
+     *  @param[in]  shape       block geometry
+     *  @param[in]  img         image to process
+     *  @param[out] out         top left pixel of the output area
+     *  @param[in]  outStride   distance between output rows in bytes
+     *
+     *  @throws vips::VError if pixels of @p img can't be loaded or don't fit into memory limit
+     */
+    void ProcessImage(DominantColorKernel kernel, const BlockShape& shape,
+        vips::VImage img, uint8_t* out, size_t outStride);
+
+    /** @brief  Process portion of an image already loaded to memory
      *
-     *  @param  task    task to be performed by a worker
+     *  @param[in]  kernel      routine that finds dominant color of a block
+     *  @param[in]  shape       block geometry
+     *  @param[in]  pixels      top left pixel of the area
+     *  @param[in]  stride      distance between area rows in bytes
+     *  @param[in]  width       area width in pixels
+     *  @param[in]  height      area height in pixels
+     *  @param[out] out         top left pixel of the output area
+     *  @param[in]  outStride   distance between output rows in bytes
      */
-    void PushTask(Task task);
+    void ProcessArea(DominantColorKernel kernel, const BlockShape& shape,
+        const uint8_t* pixels, size_t stride, uint32_t width, uint32_t height,
+        uint8_t* out, size_t outStride);
 
 private:
-    //! Mutex protecting access to @p m_tasks
+    //! Range of task indices owned by a single worker
+    struct Range
+    {
+        //! First index in upper 32 bits, index past the last one in lower 32 bits
+        std::atomic<uint64_t> bounds;
+
+        //! Keeps ranges of different workers on different cache lines
+        char padding[64 - sizeof(std::atomic<uint64_t>)];
+    };
+
+    //! Worker's routine
+    void Worker(uint32_t id);
+
+    /** @brief  Takes next index from worker's own range
+     *
+     *  @return false if the range is empty
+     */
+    bool TakeTask(uint32_t id, uint32_t& index);
+
+    /** @brief  Moves upper half of the biggest range to worker's own range
+     *
+     *  @param[in]  id      thief worker
+     *  @param[out] index   first stolen index, to be processed right away
+     *
+     *  @return false if there is nothing left to steal
+     */
+    bool StealTask(uint32_t id, uint32_t& index);
+
+    //! Worker threads
+    std::vector<std::thread> m_workers;
+
+    //! Task ranges, one per worker
+    std::unique_ptr<Range[]> m_ranges;
+
+    //! Held for the whole run, so only one run is in progress at a time
+    std::mutex m_runMutex;
+
+    //! Mutex protecting run state below
     std::mutex m_mutex;
 
-    //! A list of tasks to be processed
-    std::list<Task> m_tasks;
+    //! Wakes workers up when there is a new run or pool is stopping
+    std::condition_variable m_wake;
+
+    //! Wakes Run() up when the last worker is done
+    std::condition_variable m_done;
+
+    //! Routine of current run
+    Task m_task;
+
+    //! Incremented on every run
+    uint32_t m_generation;
+
+    //! When current run was handed to workers, by Profiler::Now(), 0 unless profiling
+    uint64_t m_runStart;
+
+    //! Number of workers still busy with current run
+    uint32_t m_busy;
+
+    //! Set when workers shall exit
+    bool m_stop;
+
+    //! Per-worker counters
+    std::unique_ptr<WorkerStats[]> m_stats;
+
+    //! Node index and CPU of every worker, CPU is -1 for workers that are not pinned
+    std::vector<uint32_t> m_workerNodes;
+    std::vector<int> m_workerCpus;
 
-    //! Image band count
-    uint32_t m_bandCount;
+    //! System ids of nodes in use
+    std::vector<uint32_t> m_nodeIds;
 
-    //! Block size
-    uint32_t m_x_blockSize;
-    uint32_t m_y_blockSize;
+    //! Shared by everyone running on the pool, null if memory is not limited
+    std::unique_ptr<MemoryBudget> m_memory;
 };
 
 #endif // ANINISCALE_WORKER_POOL_HPP
@@ -0,0 +1,577 @@
+/*
+* Copyright (c) 2017 Dmitry Odintsov
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include <vips/vips8>
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <getopt.h>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "DominantColor.hpp"
+#include "Process.hpp"
+#include "Reporter.hpp"
+#include "WorkerPool.hpp"
+
+namespace
+{
+
+//! Kinds of synthetic images
+enum Content
+{
+    //! Flat areas of a few colors with edges not aligned to blocks, like pixel art
+    CONTENT_FLAT,
+
+    //! Gradient with per-pixel noise, almost every pixel is unique, like a photo
+    CONTENT_NOISY,
+
+    //! Every pixel picked at random from a small palette, lots of close votes
+    CONTENT_PALETTE,
+
+    //! Pixel art upscaled 16 times, every block of a side dividing 16 is a single color
+    CONTENT_UPSCALED,
+
+    CONTENT_COUNT
+};
+
+const char* s_contentNames[CONTENT_COUNT] = { "flat", "noisy", "palette", "upscaled" };
+
+const uint32_t s_bandCounts[] = { 1, 3, 4 };
+
+struct BenchArguments
+{
+    std::vector<uint32_t> sizes = { 512, 2048 };
+    std::vector<uint32_t> blockSides = { 2, 4, 8, 16 };
+    std::vector<uint32_t> taskBlockSides = { 0, 16, 64 };
+    std::vector<uint32_t> threads;
+    uint32_t repeats = 3;
+    bool kernels = true;
+    bool full = true;
+    std::string workDir = "/tmp";
+    bool help = false;
+    bool valid = true;
+};
+
+//! Deterministic xorshift generator, benchmark input is the same on every run and platform
+class Random
+{
+public:
+    explicit Random(uint64_t seed)
+        : m_state(seed * 0x9E3779B97F4A7C15ull + 1)
+    {
+
+    }
+
+    uint32_t Next()
+    {
+        m_state ^= m_state << 13;
+        m_state ^= m_state >> 7;
+        m_state ^= m_state << 17;
+
+        return static_cast<uint32_t>(m_state >> 32);
+    }
+
+private:
+    uint64_t m_state;
+};
+
+/** @brief  Generates synthetic image
+ *
+ *  @return pixels, rows are packed without padding
+ */
+std::vector<uint8_t> GenerateImage(Content content, uint32_t width, uint32_t height, uint32_t bands)
+{
+    Random random(content * 1000003u + width * 31u + height * 7u + bands);
+    std::vector<uint8_t> pixels(static_cast<size_t>(width) * height * bands);
+
+    //! Small palette shared by flat and palette content
+    std::vector<uint8_t> palette(16 * bands);
+
+    for (uint8_t& sample : palette)
+    {
+        sample = random.Next() & 0xFF;
+    }
+
+    //! Flat content is a grid of cells sized so their edges cross blocks of any size,
+    //! upscaled content one of cells aligned to blocks
+    const uint32_t cellWidth = content == CONTENT_UPSCALED ? 16 : 7;
+    const uint32_t cellHeight = content == CONTENT_UPSCALED ? 16 : 5;
+    std::vector<uint8_t> cells((width / cellWidth + 1) * (height / cellHeight + 1));
+
+    for (uint8_t& cell : cells)
+    {
+        cell = random.Next() % 16;
+    }
+
+    uint8_t* pixel = pixels.data();
+
+    for (uint32_t y = 0; y < height; ++y)
+    {
+        for (uint32_t x = 0; x < width; ++x, pixel += bands)
+        {
+            switch (content)
+            {
+                case CONTENT_FLAT:
+                case CONTENT_UPSCALED:
+                {
+                    const uint8_t color = cells[(y / cellHeight) * (width / cellWidth + 1) + x / cellWidth];
+                    std::copy(&palette[color * bands], &palette[color * bands] + bands, pixel);
+                    break;
+                }
+                case CONTENT_NOISY:
+                {
+                    for (uint32_t band = 0; band < bands; ++band)
+                    {
+                        const uint32_t base = (x * (band + 1) + y * (bands - band)) * 255 / (width + height);
+                        pixel[band] = static_cast<uint8_t>(std::min(255u, base + (random.Next() & 0x3F)));
+                    }
+                    break;
+                }
+                default:
+                {
+                    const uint8_t color = random.Next() % 6;
+                    std::copy(&palette[color * bands], &palette[color * bands] + bands, pixel);
+                    break;
+                }
+            }
+        }
+    }
+
+    return pixels;
+}
+
+//! Kernel variant benchmarked in isolation
+struct KernelVariant
+{
+    const char* name;
+    DominantColorKernel kernel;
+};
+
+//! Lists every kernel able to handle @p shape on this CPU
+std::vector<KernelVariant> KernelVariants(const BlockShape& shape)
+{
+    std::vector<KernelVariant> variants;
+
+    //! Scalar goes first, other variants are checked against it
+    variants.push_back({ "scalar", &DominantColorScalar });
+
+    if (DominantColorKernel specialized = SpecializedDominantColorKernel(shape))
+    {
+        variants.push_back({ "specialized", specialized });
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    if ((shape.bands == 3 || shape.bands == 4) && shape.x * shape.y <= s_simdMaxPixels)
+    {
+        if (__builtin_cpu_supports("sse4.2"))
+        {
+            variants.push_back({ "sse42", &DominantColorSse42 });
+        }
+
+        if (__builtin_cpu_supports("avx2"))
+        {
+            variants.push_back({ "avx2", &DominantColorAvx2 });
+        }
+    }
+#endif
+
+    variants.push_back({ "selected", SelectDominantColorKernel(shape) });
+
+    return variants;
+}
+
+//! Prints a single result row
+void PrintResult(const char* suite, Content content, uint32_t size, uint32_t bands, uint32_t blockSide,
+    const std::string& taskBlockSide, uint32_t threads, const std::string& variant, double seconds, const std::string& match)
+{
+    const double megapixels = static_cast<double>(size) * size / 1e6;
+
+    std::cout << suite << "," << s_contentNames[content] << "," << size << "," << size << "," << bands << ","
+        << blockSide << "," << blockSide << "," << taskBlockSide << "," << threads << "," << variant << ","
+        << std::fixed << std::setprecision(6) << seconds << ","
+        << std::setprecision(2) << megapixels / seconds << "," << match << std::endl;
+}
+
+/** @brief  Times every kernel variant on a single worker, image is already in memory
+ *
+ *  @return number of variants whose output differs from the scalar kernel
+ */
+uint32_t BenchKernels(const BenchArguments& arguments, Content content, uint32_t size, uint32_t bands,
+    const std::vector<uint8_t>& pixels)
+{
+    typedef std::chrono::steady_clock Clock;
+
+    //! Kernels run on the calling thread, pool is only needed for ProcessArea()
+    WorkerPool pool(1);
+    uint32_t mismatches = 0;
+
+    for (uint32_t side : arguments.blockSides)
+    {
+        BlockShape shape;
+        shape.bands = bands;
+        shape.sampleBytes = 1;
+        shape.x = side;
+        shape.y = side;
+
+        const uint32_t tiles = size / side;
+        const size_t outStride = tiles * bands;
+
+        std::vector<uint8_t> expected;
+
+        for (const KernelVariant& variant : KernelVariants(shape))
+        {
+            std::vector<uint8_t> out(tiles * outStride);
+            double best = 0;
+
+            for (uint32_t repeat = 0; repeat < arguments.repeats; ++repeat)
+            {
+                const Clock::time_point start = Clock::now();
+
+                pool.ProcessArea(variant.kernel, shape, pixels.data(), size * bands, size, size, out.data(), outStride);
+
+                const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+                best = repeat ? std::min(best, seconds) : seconds;
+            }
+
+            if (expected.empty())
+            {
+                expected = out;
+            }
+
+            const bool match = out == expected;
+            mismatches += match ? 0 : 1;
+
+            PrintResult("kernel", content, size, bands, side, "", 1, variant.name, best, match ? "1" : "0");
+        }
+    }
+
+    return mismatches;
+}
+
+/** @brief  Times Process(), ProcessStream() and ProcessPipeline() from file to file
+ *
+ *  @return number of runs that failed
+ */
+uint32_t BenchFull(const BenchArguments& arguments, Content content, uint32_t size, uint32_t bands,
+    std::vector<uint8_t>& pixels, const std::string& dir)
+{
+    typedef std::chrono::steady_clock Clock;
+
+    const std::string in = dir + "/input.png";
+    const std::string out = dir + "/output.png";
+
+    vips::VImage::new_from_memory(pixels.data(), pixels.size(), size, size, bands, VIPS_FORMAT_UCHAR)
+        .pngsave( (char*) in.c_str() );
+
+    struct Mode
+    {
+        const char* name;
+        int (*process)(WorkerPool&, const Arguments&);
+    };
+
+    const Mode modes[] = {
+        { "whole", &Process },
+        { "stream", &ProcessStream },
+        { "pipeline", &ProcessPipeline },
+    };
+
+    uint32_t failures = 0;
+
+    for (uint32_t threads : arguments.threads)
+    {
+        WorkerPool pool(threads);
+
+        for (uint32_t side : arguments.blockSides)
+        {
+            for (uint32_t taskBlockSide : arguments.taskBlockSides)
+            {
+                Arguments image;
+                image.in = in;
+                image.out = out;
+                image.x_blockSize = side;
+                image.y_blockSize = side;
+                image.taskBlockSide = taskBlockSide;
+
+                for (const Mode& mode : modes)
+                {
+                    double best = 0;
+                    bool failed = false;
+
+                    for (uint32_t repeat = 0; repeat < arguments.repeats && !failed; ++repeat)
+                    {
+                        //! Keep processing log out of the results
+                        std::ostringstream log;
+                        std::streambuf* console = std::cout.rdbuf(log.rdbuf());
+
+                        const Clock::time_point start = Clock::now();
+                        failed = 0 != mode.process(pool, image);
+                        const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+                        std::cout.rdbuf(console);
+
+                        if (failed)
+                        {
+                            std::cerr << log.str();
+                        }
+
+                        best = repeat ? std::min(best, seconds) : seconds;
+                    }
+
+                    if (failed)
+                    {
+                        ++failures;
+                        continue;
+                    }
+
+                    std::ostringstream task;
+
+                    if (taskBlockSide)
+                    {
+                        task << taskBlockSide;
+                    }
+                    else
+                    {
+                        task << "auto";
+                    }
+
+                    PrintResult("full", content, size, bands, side, task.str(), threads, mode.name, best, "");
+                }
+            }
+        }
+    }
+
+    unlink(in.c_str());
+    unlink(out.c_str());
+
+    return failures;
+}
+
+//! Parses comma separated list of positive integers
+bool ParseList(const char* text, std::vector<uint32_t>& list, int minimum = 1)
+{
+    list.clear();
+
+    std::istringstream stream(text);
+    std::string item;
+
+    while (std::getline(stream, item, ','))
+    {
+        const int value = atoi(item.c_str());
+
+        if (value < minimum)
+        {
+            return false;
+        }
+
+        list.push_back(value);
+    }
+
+    return !list.empty();
+}
+
+BenchArguments ProcessArgs(int argc, char** argv)
+{
+    static struct option options[] = {
+        {"sizes", required_argument, 0, 's'},
+        {"blocks", required_argument, 0, 'x'},
+        {"task-block-sides", required_argument, 0, 't'},
+        {"threads", required_argument, 0, 'j'},
+        {"repeats", required_argument, 0, 'n'},
+
+        {"kernels-only", no_argument, 0, 'k'},
+        {"full-only", no_argument, 0, 'f'},
+
+        {"work-dir", required_argument, 0, 'd'},
+
+        {"help", no_argument, 0, 'h'},
+
+        {0, 0, 0, 0}
+    };
+
+    BenchArguments arguments;
+
+    //! Single worker and every core by default
+    const uint32_t cores = std::max(1u, std::thread::hardware_concurrency());
+    arguments.threads.push_back(1);
+
+    if (cores > 1)
+    {
+        arguments.threads.push_back(cores);
+    }
+
+    while (true)
+    {
+        int c = getopt_long(argc, argv, "s:x:t:j:n:kfd:h", options, 0);
+
+        if (c == -1)
+        {
+            break;
+        }
+
+        switch (c)
+        {
+            case 's': // sizes
+            {
+                arguments.valid &= ParseList(optarg, arguments.sizes);
+                break;
+            }
+            case 'x': // blocks
+            {
+                arguments.valid &= ParseList(optarg, arguments.blockSides);
+                break;
+            }
+            case 't': // task-block-sides
+            {
+                arguments.valid &= ParseList(optarg, arguments.taskBlockSides, 0);
+                break;
+            }
+            case 'j': // threads
+            {
+                arguments.valid &= ParseList(optarg, arguments.threads);
+                break;
+            }
+            case 'n': // repeats
+            {
+                arguments.repeats = std::max(1, atoi(optarg));
+                break;
+            }
+            case 'k': // kernels-only
+            {
+                arguments.full = false;
+                break;
+            }
+            case 'f': // full-only
+            {
+                arguments.kernels = false;
+                break;
+            }
+            case 'd': // work-dir
+            {
+                arguments.workDir = std::string(optarg);
+                break;
+            }
+            case 'h': // help
+            default:
+            {
+                arguments.help = true;
+                break;
+            }
+        }
+    }
+
+    return arguments;
+}
+
+void PrintUsage()
+{
+    const uint32_t width = 32;
+
+    std::cout << "Usage:" << std::endl;
+    std::cout << "aniniscale-bench [options]" << std::endl;
+    std::cout << std::endl;
+    std::cout << "Times dominant color kernels and whole processing on synthetic images," << std::endl;
+    std::cout << "results are printed as CSV, one row per configuration." << std::endl;
+    std::cout << std::endl;
+    std::cout << "Optional arguments:" << std::endl;
+    std::cout << "  " << std::left << std::setw(width) << "-h, --help" << "prints this message" << std::endl;
+    std::cout << "  " << std::left << std::setw(width) << "-s LIST, --sizes=LIST" << "image sides in pixels [default 512,2048]" << std::endl;
+    std::cout << "  " << std::left << std::setw(width) << "-x LIST, --blocks=LIST" << "block sides [default 2,4,8,16]" << std::endl;
+    std::cout << "  " << std::left << std::setw(width) << "-t LIST, --task-block-sides=LIST" << "task block sides for full runs, 0 to fit tasks to cache [default 0,16,64]" << std::endl;
+    std::cout << "  " << std::left << std::setw(width) << "-j LIST, --threads=LIST" << "worker counts for full runs [default 1 and every core]" << std::endl;
+    std::cout << "  " << std::left << std::setw(width) << "-n NUM, --repeats=NUM" << "runs per configuration, the fastest is reported [default 3]" << std::endl;
+    std::cout << "  " << std::left << std::setw(width) << "-k, --kernels-only" << "skip full runs" << std::endl;
+    std::cout << "  " << std::left << std::setw(width) << "-f, --full-only" << "skip kernel runs" << std::endl;
+    std::cout << "  " << std::left << std::setw(width) << "-d DIR, --work-dir=DIR" << "where temporary images are written [default /tmp]" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    //! Initialize VIPS library
+    if( VIPS_INIT( argv[0] ) )
+    {
+        return -1;
+    }
+
+    BenchArguments arguments = ProcessArgs(argc, argv);
+
+    if (arguments.help || !arguments.valid)
+    {
+        PrintUsage();
+
+        return arguments.help ? 0 : -1;
+    }
+
+    //! Runs are short, progress reports would only get in the way
+    Reporter::s_minTimeout = 3600;
+
+    std::string dir = arguments.workDir + "/aniniscale-bench-XXXXXX";
+
+    if (arguments.full && !mkdtemp(&dir[0]))
+    {
+        std::cerr << "Can't create temporary directory in " << arguments.workDir.c_str() << std::endl;
+        return -1;
+    }
+
+    std::cout << "suite,content,width,height,bands,x_block,y_block,task_block_side,threads,variant,seconds,mpx_per_s,match" << std::endl;
+
+    uint32_t mismatches = 0;
+    uint32_t failures = 0;
+
+    for (uint32_t size : arguments.sizes)
+    {
+        for (uint32_t bands : s_bandCounts)
+        {
+            for (uint32_t content = 0; content < CONTENT_COUNT; ++content)
+            {
+                std::cerr << "Benchmarking " << s_contentNames[content] << " " << size << "x" << size
+                    << " image with " << bands << " bands" << std::endl;
+
+                std::vector<uint8_t> pixels = GenerateImage(static_cast<Content>(content), size, size, bands);
+
+                if (arguments.kernels)
+                {
+                    mismatches += BenchKernels(arguments, static_cast<Content>(content), size, bands, pixels);
+                }
+
+                if (arguments.full)
+                {
+                    failures += BenchFull(arguments, static_cast<Content>(content), size, bands, pixels, dir);
+                }
+            }
+        }
+    }
+
+    if (arguments.full)
+    {
+        rmdir(dir.c_str());
+    }
+
+    //! Deinitialize
+    vips_shutdown();
+
+    if (mismatches)
+    {
+        std::cerr << mismatches << " kernel runs produced results different from scalar kernel" << std::endl;
+    }
+
+    if (failures)
+    {
+        std::cerr << failures << " full runs failed" << std::endl;
+    }
+
+    return (mismatches || failures) ? -1 : 0;
+}
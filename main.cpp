@@ -6,53 +6,34 @@
 
 #include <vips/vips8>
 
+#include <algorithm>
 #include <cstdlib>
 #include <getopt.h>
 #include <iomanip>
 #include <iostream>
-#include <map>
+#include <memory>
+#include <string>
 #include <thread>
-#include <vector>
 
+#include "Process.hpp"
+#include "Profiler.hpp"
 #include "Reporter.hpp"
+#include "Server.hpp"
 #include "WorkerPool.hpp"
 
 static const char* s_appName = "aniniscale";
-static const char* s_versionInfo = "1.0.1";
-
-struct Arguments
-{
-    // Required
-    std::string in;
-    std::string out;
-
-    // Optional
-    int x_blockSize = 8;
-    int y_blockSize = 8;
-    int taskBlockSide = 64;
-    int reportingTimeout = 5;
-    bool help = false;
-
-    //! Returns the validity of argument set
-    bool IsValid() const
-    {
-        // arguments are valid only if:
-        return !in.empty() && !out.empty() &&   // both in and out are set
-            !help &&                            // -h/--help is not set
-            x_blockSize >= 1 && y_blockSize >= 1;       // x and y block sizes are positive integers
-    }
-};
+static const char* s_versionInfo = "1.1.0";
 
 void PrintUsage(const Arguments& arguments)
 {
     if (!arguments.help && !arguments.IsValid())
     {
-        if (arguments.in.empty())
+        if (arguments.in.empty() && arguments.serve.empty())
         {
             std::cout << "Input image path is required!" << std::endl;
         }
 
-        if (arguments.out.empty())
+        if (arguments.out.empty() && arguments.serve.empty())
         {
             std::cout << "Output image path is required!" << std::endl;
         }
@@ -67,6 +48,100 @@ void PrintUsage(const Arguments& arguments)
             std::cout << "-y/--y-block must be a positive integer" << std::endl;
         }
 
+        if (arguments.taskBlockSide < 0)
+        {
+            std::cout << "-t/--task-block-side must be a positive integer, or 0 to pick it automatically" << std::endl;
+        }
+
+        if (arguments.workers < 0)
+        {
+            std::cout << "-w/--workers must be a positive integer, or 0 for one per hardware thread" << std::endl;
+        }
+
+        if (arguments.maxMemory < 0)
+        {
+            std::cout << "-M/--max-memory must be a positive integer, or 0 for no limit" << std::endl;
+        }
+
+        if (!arguments.autotune.empty() && arguments.taskBlockSide > 0)
+        {
+            std::cout << "-A/--autotune can't be combined with -t/--task-block-side" << std::endl;
+        }
+
+        if (!arguments.autotune.empty() && arguments.numa)
+        {
+            std::cout << "-A/--autotune can't be combined with -N/--numa" << std::endl;
+        }
+
+        if (arguments.perfCounters && arguments.profile.empty())
+        {
+            std::cout << "-E/--perf-counters needs -G/--profile" << std::endl;
+        }
+
+        if (!arguments.format.empty() && ParseOutputFormat(arguments.format) == OUTPUT_FORMAT_UNKNOWN)
+        {
+            std::cout << "-f/--format must be one of png, webp, ppm, raw, gif or tiff" << std::endl;
+        }
+
+        if (arguments.compression < -1 || arguments.compression > 9)
+        {
+            std::cout << "-c/--compression must be between 0 and 9" << std::endl;
+        }
+
+        int filter = 0;
+
+        if (!arguments.pngFilter.empty() && !ParsePngFilter(arguments.pngFilter, filter))
+        {
+            std::cout << "-F/--png-filter must be a list of none, sub, up, avg, paeth or all" << std::endl;
+        }
+
+        if (arguments.incremental && (arguments.stream || arguments.pipeline))
+        {
+            std::cout << "-I/--incremental can't be combined with -s/--stream or -p/--pipeline" << std::endl;
+        }
+
+        if (arguments.palette && (arguments.Encoding().format != OUTPUT_FORMAT_PNG || arguments.stream ||
+            arguments.pipeline || arguments.incremental || arguments.numa || !arguments.pyramid.empty() ||
+            !arguments.serve.empty() || !arguments.connect.empty()))
+        {
+            std::cout << "-L/--palette needs png output and can't be combined with -s, -p, -I, -N, -P, -S or -C" << std::endl;
+        }
+
+        std::vector<BlockSize> sizes;
+
+        if (!arguments.pyramid.empty() && !ParseBlockSizes(arguments.pyramid, sizes))
+        {
+            std::cout << "-P/--pyramid must be a list of block sizes, each a multiple of the previous one" << std::endl;
+        }
+
+        if (!arguments.pyramid.empty() && (arguments.stream || arguments.pipeline || arguments.incremental ||
+            arguments.batch || !arguments.cache.empty()))
+        {
+            std::cout << "-P/--pyramid can't be combined with -s, -p, -I, -b or -d" << std::endl;
+        }
+
+        if (arguments.shm && arguments.connect.empty())
+        {
+            std::cout << "-m/--shm needs -C/--connect" << std::endl;
+        }
+
+        if (!arguments.connect.empty() && (!arguments.serve.empty() || arguments.batch || !arguments.pyramid.empty() ||
+            arguments.stream || arguments.pipeline || arguments.incremental || !arguments.cache.empty() ||
+            arguments.maxMemory > 0))
+        {
+            std::cout << "-C/--connect can't be combined with -S, -b, -P, -s, -p, -I, -d or -M" << std::endl;
+        }
+
+        if (!arguments.serve.empty() && (arguments.batch || !arguments.pyramid.empty()))
+        {
+            std::cout << "-S/--serve can't be combined with -b or -P" << std::endl;
+        }
+
+        if (arguments.cacheSize < 1)
+        {
+            std::cout << "-D/--cache-size must be a positive integer" << std::endl;
+        }
+
         std::cout << std::endl;
     }
 
@@ -80,13 +155,15 @@ void PrintUsage(const Arguments& arguments)
         std::cout << "  - initial image size;" << std::endl;
         std::cout << "  - number of processing threads;" << std::endl;
         std::cout << "  - block size;" << std::endl;
-        std::cout << "  - number of blocks inside each task." << std::endl;
+        std::cout << "  - size of the per-core cache, unless number of blocks along each side of a task is given;" << std::endl;
+        std::cout << "  - timings of a few candidate task sizes, if tuning is requested." << std::endl;
         std::cout << std::endl;
         std::cout << "Each task consists of the following steps:" << std::endl;
         std::cout << "  1. Pick a block of pixels" << std::endl;
         std::cout << "  2. Find dominant color in this block" << std::endl;
         std::cout << "  3. Write dominant color to resulting image" << std::endl;
-        std::cout << "After all tasks are complete, resulting image is saved as png" << std::endl;
+        std::cout << "After all tasks are complete, resulting image is saved in format matching output extension," << std::endl;
+        std::cout << "png unless another one is requested" << std::endl;
         std::cout << std::endl;
     }
 
@@ -107,8 +184,29 @@ void PrintUsage(const Arguments& arguments)
     std::cout << "  " << std::left << std::setw(optionalWidth) << "-h, --help" << "prints detailed help message" << std::endl;
     std::cout << "  " << std::left << std::setw(optionalWidth) << "-x NUM, --x-block=NUM" << "block size on X axis [default " << defaultArgs.x_blockSize << "]" << std::endl;
     std::cout << "  " << std::left << std::setw(optionalWidth) << "-y NUM, --y-block=NUM" << "block size on Y axis [default " <<  defaultArgs.y_blockSize << "]" << std::endl;
-    std::cout << "  " << std::left << std::setw(optionalWidth) << "-t NUM, --task-block-side=NUM" << "maximum number of blocks in any processing task [default " << defaultArgs.taskBlockSide << "]" << std::endl;
+    std::cout << "  " << std::left << std::setw(optionalWidth) << "-t NUM, --task-block-side=NUM" << "maximum number of blocks along each side of a processing task [default 0, fit tasks to cache]" << std::endl;
+    std::cout << "  " << std::left << std::setw(optionalWidth) << "-w NUM, --workers=NUM" << "number of worker threads [default 0, one per hardware thread]" << std::endl;
+    std::cout << "  " << std::left << std::setw(optionalWidth) << "-T, --pin" << "pin every worker to a CPU, spreading workers over NUMA nodes" << std::endl;
+    std::cout << "  " << std::left << std::setw(optionalWidth) << "-N, --numa" << "like --pin, and every node loads and processes its own band of the image" << std::endl;
+    std::cout << "  " << std::left << std::setw(optionalWidth) << "-M NUM, --max-memory=NUM" << "megabytes of images and task buffers in memory at once, work waits for room [default 0, no limit]" << std::endl;
+    std::cout << "  " << std::left << std::setw(optionalWidth) << "-G FILE, --profile=FILE" << "write spans of every thread and phase to FILE as Chrome trace JSON" << std::endl;
+    std::cout << "  " << std::left << std::setw(optionalWidth) << "-E, --perf-counters" << "with --profile, count cycles, instructions and cache misses of compute spans" << std::endl;
+    std::cout << "  " << std::left << std::setw(optionalWidth) << "-A FILE, --autotune=FILE" << "time a few task sizes on a sample of every new image shape, remember the fastest in FILE" << std::endl;
     std::cout << "  " << std::left << std::setw(optionalWidth) << "-r NUM, --reporting-timeout=NUM" << "minimum timeout between log reports in seconds [default " << defaultArgs.reportingTimeout << "]" << std::endl;
+    std::cout << "  " << std::left << std::setw(optionalWidth) << "-s, --stream" << "read input sequentially in horizontal strips to bound memory use" << std::endl;
+    std::cout << "  " << std::left << std::setw(optionalWidth) << "-p, --pipeline" << "like --stream, but decode, process and encode strips concurrently" << std::endl;
+    std::cout << "  " << std::left << std::setw(optionalWidth) << "-b, --batch" << "INPUT is a directory or a file listing images, OUTPUT is a directory" << std::endl;
+    std::cout << "  " << std::left << std::setw(optionalWidth) << "-P LIST, --pyramid=LIST" << "save OUTPUT_XxY for every nested block size in LIST, e.g. 2,4,8 or 2x2,4x4, from one decode" << std::endl;
+    std::cout << "  " << std::left << std::setw(optionalWidth) << "-I, --incremental" << "process only blocks changed since previous run into the same OUTPUT, keeps OUTPUT.blocks" << std::endl;
+    std::cout << "  " << std::left << std::setw(optionalWidth) << "-f FORMAT, --format=FORMAT" << "output format: png, webp (lossless), ppm, raw, gif or tiff [default by OUTPUT extension, png]" << std::endl;
+    std::cout << "  " << std::left << std::setw(optionalWidth) << "-c NUM, --compression=NUM" << "png zlib level 0-9 or webp effort 0-6, lower is faster [default encoder's]" << std::endl;
+    std::cout << "  " << std::left << std::setw(optionalWidth) << "-F LIST, --png-filter=LIST" << "png row filters: none, sub, up, avg, paeth or all [default encoder's]" << std::endl;
+    std::cout << "  " << std::left << std::setw(optionalWidth) << "-L, --palette" << "save images of up to 256 colors as indexed png, votes count palette indices" << std::endl;
+    std::cout << "  " << std::left << std::setw(optionalWidth) << "-S PATH, --serve=PATH" << "keep running and serve requests on Unix socket PATH, INPUT and OUTPUT are not needed" << std::endl;
+    std::cout << "  " << std::left << std::setw(optionalWidth) << "-C PATH, --connect=PATH" << "send request to server on Unix socket PATH instead of processing here" << std::endl;
+    std::cout << "  " << std::left << std::setw(optionalWidth) << "-m, --shm" << "with --connect, read and write images here, pass pixels in shared memory" << std::endl;
+    std::cout << "  " << std::left << std::setw(optionalWidth) << "-d DIR, --cache=DIR" << "reuse results stored in DIR for identical input and options, add new ones" << std::endl;
+    std::cout << "  " << std::left << std::setw(optionalWidth) << "-D NUM, --cache-size=NUM" << "cache size limit in megabytes, least recently used results are removed [default " << defaultArgs.cacheSize << "]" << std::endl;
 }
 
 Arguments ProcessArgs(int argc, char** argv)
@@ -121,9 +219,34 @@ Arguments ProcessArgs(int argc, char** argv)
         {"output", required_argument, 0, 'o'},
 
         {"task-block-side", required_argument, 0, 't'},
+        {"workers", required_argument, 0, 'w'},
+        {"autotune", required_argument, 0, 'A'},
+        {"pin", no_argument, 0, 'T'},
+        {"numa", no_argument, 0, 'N'},
+        {"max-memory", required_argument, 0, 'M'},
+        {"profile", required_argument, 0, 'G'},
+        {"perf-counters", no_argument, 0, 'E'},
 
         {"reporting-timeout", required_argument, 0, 'r'},
 
+        {"stream", no_argument, 0, 's'},
+        {"pipeline", no_argument, 0, 'p'},
+        {"batch", no_argument, 0, 'b'},
+        {"incremental", no_argument, 0, 'I'},
+        {"pyramid", required_argument, 0, 'P'},
+
+        {"format", required_argument, 0, 'f'},
+        {"compression", required_argument, 0, 'c'},
+        {"png-filter", required_argument, 0, 'F'},
+        {"palette", no_argument, 0, 'L'},
+
+        {"serve", required_argument, 0, 'S'},
+        {"connect", required_argument, 0, 'C'},
+        {"shm", no_argument, 0, 'm'},
+
+        {"cache", required_argument, 0, 'd'},
+        {"cache-size", required_argument, 0, 'D'},
+
         {"help", no_argument, 0, 'h'},
 
         {0, 0, 0, 0}
@@ -133,7 +256,7 @@ Arguments ProcessArgs(int argc, char** argv)
 
     while (true)
     {
-        int c = getopt_long(argc, argv, "x:y:i:o:t:r:h", options, 0);
+        int c = getopt_long(argc, argv, "x:y:i:o:t:w:A:TNM:G:Er:spbIP:f:c:F:LS:C:md:D:h", options, 0);
 
         if (c == -1)
         {
@@ -167,11 +290,116 @@ Arguments ProcessArgs(int argc, char** argv)
                 arguments.taskBlockSide = atoi(optarg);
                 break;
             }
+            case 'w': // workers
+            {
+                arguments.workers = atoi(optarg);
+                break;
+            }
+            case 'A': // autotune
+            {
+                arguments.autotune = std::string(optarg);
+                break;
+            }
+            case 'T': // pin
+            {
+                arguments.pin = true;
+                break;
+            }
+            case 'N': // numa
+            {
+                arguments.numa = true;
+                break;
+            }
+            case 'M': // max-memory
+            {
+                arguments.maxMemory = atoi(optarg);
+                break;
+            }
+            case 'G': // profile
+            {
+                arguments.profile = std::string(optarg);
+                break;
+            }
+            case 'E': // perf-counters
+            {
+                arguments.perfCounters = true;
+                break;
+            }
             case 'r': // reporting-timeout
             {
                 arguments.reportingTimeout = atoi(optarg);
                 break;
             }
+            case 's': // stream
+            {
+                arguments.stream = true;
+                break;
+            }
+            case 'p': // pipeline
+            {
+                arguments.pipeline = true;
+                break;
+            }
+            case 'b': // batch
+            {
+                arguments.batch = true;
+                break;
+            }
+            case 'I': // incremental
+            {
+                arguments.incremental = true;
+                break;
+            }
+            case 'P': // pyramid
+            {
+                arguments.pyramid = std::string(optarg);
+                break;
+            }
+            case 'f': // format
+            {
+                arguments.format = std::string(optarg);
+                break;
+            }
+            case 'c': // compression
+            {
+                arguments.compression = atoi(optarg);
+                break;
+            }
+            case 'F': // png-filter
+            {
+                arguments.pngFilter = std::string(optarg);
+                break;
+            }
+            case 'L': // palette
+            {
+                arguments.palette = true;
+                break;
+            }
+            case 'S': // serve
+            {
+                arguments.serve = std::string(optarg);
+                break;
+            }
+            case 'C': // connect
+            {
+                arguments.connect = std::string(optarg);
+                break;
+            }
+            case 'm': // shm
+            {
+                arguments.shm = true;
+                break;
+            }
+            case 'd': // cache
+            {
+                arguments.cache = std::string(optarg);
+                break;
+            }
+            case 'D': // cache-size
+            {
+                arguments.cacheSize = atoi(optarg);
+                break;
+            }
             case 'h': // help
             {
                 arguments.help = true;
@@ -187,222 +415,131 @@ Arguments ProcessArgs(int argc, char** argv)
     return arguments;
 }
 
-int Process(const Arguments& arguments)
+int main(int argc, char** argv)
 {
-    //! Open the image and check channel count
-    vips::VImage img;
-
-    try
-    {
-        img = vips::VImage::new_from_file( arguments.in.c_str() );
-    }
-    catch( vips::VError& e )
+    //! Initialize VIPS library
+    if( VIPS_INIT( argv[0] ) )
     {
-        std::cout << "Error occured while opening image " << arguments.in.c_str() << std::endl;
-        std::cerr << e.what() << std::endl;
         return -1;
     }
 
-    int bandCount = img.bands();
-
-    //! If both blocks are 1, we can just save the image
-    if (arguments.x_blockSize == 1 && arguments.y_blockSize == 1)
-    {
-        img.pngsave( (char*) arguments.out.c_str() );
-        return 0;
-    }
-
-    //! Get image information and estimate how it will be divided
-    const uint32_t width = img.width();
-    const uint32_t height = img.height();
-
-    const uint32_t x_tiles = width / arguments.x_blockSize;
-    const uint32_t y_tiles = height / arguments.y_blockSize;
-
-    uint32_t totalPixels = width * height;
-
-    //! Check how many threads we can run
-    uint32_t workerCount = std::thread::hardware_concurrency();
+    std::string in;
+    std::string out;
+    bool help = false;
 
-    //! Make sure it's a multiple of 2
-    if (workerCount % 2 != 0)
-    {
-        workerCount += workerCount % 2;
-    }
+    Arguments arguments = ProcessArgs(argc, argv);
 
-    //! If we have too much workers, cut their number until we have enough work
-    while (workerCount > x_tiles || workerCount > y_tiles)
+    if (!arguments.IsValid())
     {
-        workerCount -= 2;
-    }
+        PrintUsage(arguments);
 
-    //! If we ended up without workers, bring back one
-    if (0 == workerCount)
-    {
-        workerCount = 1;
+        return help ? 0 : -1;
     }
 
-    //! Tasks shall not be too big, so we keep them manageable
-    int x_sectionsInTask = x_tiles / workerCount;
+    Reporter::s_minTimeout = std::max(1, arguments.reportingTimeout);
 
-    while (x_sectionsInTask > arguments.taskBlockSide)
+    //! Client leaves all the work to the server
+    if (!arguments.connect.empty())
     {
-        x_sectionsInTask /= 2;
-    }
+        const int retVal = RunClient(arguments);
+        vips_shutdown();
 
-    int y_sectionsInTask = y_tiles / workerCount;
+        return retVal;
+    }
 
-    while (y_sectionsInTask > arguments.taskBlockSide)
+    if (!arguments.profile.empty())
     {
-        y_sectionsInTask /= 2;
+        Profiler::Enable(arguments.perfCounters);
+        Profiler::NameThread("main");
     }
 
-    const uint32_t x_taskSize = x_sectionsInTask * arguments.x_blockSize;
-    const uint32_t y_taskSize = y_sectionsInTask * arguments.y_blockSize;
-
-    const uint32_t x_taskCount = width / x_taskSize;
-    const uint32_t y_taskCount = height / y_taskSize;
-
-    //! Store total number of pixels on the image for the reporting
-    Reporter::s_taskPixels = x_taskSize * y_taskSize;
-    Reporter::s_tasksTotal = x_taskCount * y_taskCount;
-
-    WorkerPool pool(bandCount, arguments.x_blockSize, arguments.y_blockSize);
+    //! Workers are shared by every image processed
+    const uint32_t workerCount = arguments.workers > 0 ? arguments.workers : std::max(1u, std::thread::hardware_concurrency());
 
-    std::cout << "Creating " << x_taskCount * y_taskCount << " tasks of size " << x_taskSize << "x" << y_taskSize << std::endl;
+    std::cout << "Initializing " << workerCount << " workers" << std::endl;
 
-    std::map<std::pair<uint32_t, uint32_t>, std::vector<uint8_t>> result;
+    int retVal = 0;
+    std::unique_ptr<ResultCache> cache;
 
-    //! Allocate all needed memory
-    for (uint32_t x_task = 0; x_task < x_taskCount; ++x_task)
+    if (!arguments.cache.empty())
     {
-        for (uint32_t y_task = 0; y_task < y_taskCount; ++y_task)
-        {
-            result[std::pair<uint32_t, uint32_t>(x_task, y_task)].resize(x_sectionsInTask * y_sectionsInTask * bandCount);
-        }
-    }
-
-    auto ReportTaskCreationProgress = [&](uint32_t count){
-        static std::time_t lastTime = std::time(0);
-        const std::time_t now = std::time(0);
-
-        if (now - lastTime > 5)
+        try
         {
-            std::cout << "Progress: " << count << "/" << result.size() << std::endl;
-            lastTime = now;
+            cache.reset(new ResultCache(arguments.cache, static_cast<uint64_t>(arguments.cacheSize) << 20));
         }
-    };
-
-    //! Create tasks to process each section
-    for (uint32_t x_task = 0; x_task < x_taskCount; ++x_task)
-    {
-        for (uint32_t y_task = 0; y_task < y_taskCount; ++y_task)
+        catch( vips::VError& e )
         {
-            std::pair<uint32_t, uint32_t> coords(x_task, y_task);
-
-            vips::VImage area = img.extract_area(coords.first * x_taskSize,
-                coords.second * y_taskSize,
-                x_taskSize,
-                y_taskSize);
+            std::cout << "Error occured while opening cache " << arguments.cache.c_str() << std::endl;
+            std::cerr << e.what() << std::endl;
+            vips_shutdown();
 
-            pool.PushTask([=, &result](WorkerPool& worker){ worker.ProcessImage(area, result[std::pair<uint32_t, uint32_t>(x_task, y_task)]); });
-
-            ReportTaskCreationProgress(x_task * y_taskCount + y_task);
+            return -1;
         }
     }
 
-    std::cout << "Task creation complete" << std::endl;
-
-    std::cout << "Total area to be processed: " << width << "x" << height << " (" << totalPixels << "px)" << std::endl;
-
-    //! Spawn workers
-    std::vector<std::thread> workers;
-    workers.resize(workerCount);
-
-    std::cout << "Initializing " << workerCount << " workers" << std::endl;
-
-    for (uint32_t i = 0; i < workerCount; ++i)
-    {
-        workers[i] = std::thread(&WorkerPool::Worker, &pool);
-    }
-
-    //! Wait for all workers to finish
-    for (uint32_t i = 0; i < workerCount; ++i)
     {
-        workers[i].join();
-    }
+        WorkerPool pool(workerCount, arguments.pin || arguments.numa);
 
-    workers.clear();
+        if (arguments.pin || arguments.numa)
+        {
+            std::cout << "Workers pinned to CPUs of " << pool.NodeCount() << " NUMA nodes" << std::endl;
+        }
 
-    std::cout << "Processing complete, preparing resulting image" << std::endl;
+        if (arguments.maxMemory > 0)
+        {
+            const uint64_t limit = static_cast<uint64_t>(arguments.maxMemory) << 20;
+            pool.LimitMemory(limit);
 
-    //! Prepare the buffer to store final output
-    std::vector<uint8_t> outBuffer;
-    outBuffer.resize(x_tiles * y_tiles * bandCount);
+            //! Images bigger than the limit are decoded by libvips to a temporary file instead of memory,
+            //! and finished operations are not kept around in its cache
+            setenv("VIPS_DISC_THRESHOLD", std::to_string(limit).c_str(), 1);
+            vips_cache_set_max(0);
 
-    vips::VImage outImg = vips::VImage::new_from_memory(outBuffer.data(), outBuffer.size(),
-        x_tiles, y_tiles, bandCount, img.format());
+            std::cout << "Memory limited to " << arguments.maxMemory << "MB" << std::endl;
+        }
 
-    try
-    {
-        //! Go through worker results and place them in resulting image
-        for (auto& r : result)
+        if (!arguments.serve.empty())
         {
-            const std::pair<uint32_t, uint32_t>& coords = r.first;
-            std::vector<uint8_t>& buffer = r.second;
-            vips::VImage block = vips::VImage::new_from_memory(buffer.data(), buffer.size(),
-                x_sectionsInTask, y_sectionsInTask, bandCount, img.format());
-
-            outImg = outImg.insert(block, coords.first * x_sectionsInTask, coords.second * y_sectionsInTask);
+            retVal = Serve(pool, arguments, cache.get());
+        }
+        else if (!arguments.pyramid.empty())
+        {
+            retVal = ProcessPyramid(pool, arguments);
+        }
+        else if (arguments.batch)
+        {
+            retVal = ProcessBatch(pool, arguments, cache.get());
+        }
+        else
+        {
+            retVal = ProcessSingle(pool, arguments, cache.get());
         }
-    }
-    catch( vips::VError& e )
-    {
-        std::cout << "Error occured while preparing resulting image" << std::endl;
-        std::cerr << e.what() << std::endl;
-        return -1;
-    }
-
-    try
-    {
-        std::cout << "Saving resulting image" << std::endl;
 
-        //! Save the image
-        outImg.pngsave( (char*) arguments.out.c_str() );
-    }
-    catch( vips::VError& e )
-    {
-        std::cout << "Error occured while saving resulting image to " << arguments.out.c_str() << std::endl;
-        std::cerr << e.what() << std::endl;
-        return -1;
+        if (pool.Memory())
+        {
+            std::cout << "Peak memory accounted: " << ((pool.Memory()->Peak() + (1 << 20) - 1) >> 20) << "MB of "
+                << arguments.maxMemory << "MB" << std::endl;
+        }
     }
 
-    return 0;
-}
-
-int main(int argc, char** argv)
-{
-    //! Initialize VIPS library
-    if( VIPS_INIT( argv[0] ) )
+    //! Workers are gone by now, nobody records spans any more
+    if (!arguments.profile.empty())
     {
-        return -1;
+        if (Profiler::Write(arguments.profile))
+        {
+            std::cout << "Profile written to " << arguments.profile.c_str() << std::endl;
+        }
+        else
+        {
+            std::cout << "Unable to write profile to " << arguments.profile.c_str() << std::endl;
+        }
     }
 
-    std::string in;
-    std::string out;
-    bool help = false;
-
-    Arguments arguments = ProcessArgs(argc, argv);
-
-    if (!arguments.IsValid())
+    if (cache)
     {
-        PrintUsage(arguments);
-
-        return help ? 0 : -1;
+        std::cout << "Result cache: " << cache->Hits() << " hits, " << cache->Misses() << " misses" << std::endl;
     }
 
-    int retVal = Process(arguments);
-
     //! Deinitialize
     vips_shutdown();
 
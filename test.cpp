@@ -0,0 +1,418 @@
+/*
+* Copyright (c) 2017 Dmitry Odintsov
+* This code is licensed under the MIT license (MIT)
+* (http://opensource.org/licenses/MIT)
+*/
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "DominantColor.hpp"
+#include "WorkerPool.hpp"
+
+namespace
+{
+
+//! Kinds of random blocks
+enum Content
+{
+    //! Pixels picked from a few colors, close votes and ties are common
+    CONTENT_FEW,
+
+    //! Two colors with exactly half of the pixels each
+    CONTENT_TIE,
+
+    //! As many distinct colors as the pixel size allows
+    CONTENT_DISTINCT,
+
+    //! Few colors differing in the last byte only
+    CONTENT_LAST_BYTE,
+
+    CONTENT_COUNT
+};
+
+const char* s_contentNames[CONTENT_COUNT] = { "few", "tie", "distinct", "last-byte" };
+
+//! Blocks of every shape, content and kernel checked
+const uint32_t s_blocksPerCase = 200;
+
+const uint32_t s_bandCounts[] = { 1, 2, 3, 4 };
+const uint32_t s_sampleSizes[] = { 1, 2, 4 };
+
+const uint32_t s_blockSides[][2] = {
+    { 1, 1 }, { 2, 2 }, { 3, 3 }, { 4, 4 }, { 5, 3 }, { 3, 7 }, { 8, 8 }, { 16, 16 }, { 9, 17 },
+};
+
+struct NamedKernel
+{
+    const char* name;
+    DominantColorKernel kernel;
+};
+
+//! Block embedded into a wider buffer, so kernels have to honour the stride
+struct TestBlock
+{
+    std::vector<uint8_t> buffer;
+    size_t stride;
+    size_t offset;
+
+    const uint8_t* Pixels() const
+    {
+        return buffer.data() + offset;
+    }
+};
+
+//! Writes color number @p index of a palette shared by the whole block
+void PaintColor(uint8_t* pixel, uint32_t pixelBytes, uint32_t index, Content content, uint32_t salt)
+{
+    for (uint32_t i = 0; i < pixelBytes; ++i)
+    {
+        pixel[i] = static_cast<uint8_t>(salt >> (i % 4 * 8));
+    }
+
+    if (content == CONTENT_LAST_BYTE)
+    {
+        pixel[pixelBytes - 1] = static_cast<uint8_t>(index);
+        return;
+    }
+
+    //! Index is spread over the first bytes, so distinct indices give distinct colors
+    for (uint32_t i = 0; i < pixelBytes && i < 4; ++i)
+    {
+        pixel[i] ^= static_cast<uint8_t>(index >> (i * 8));
+    }
+}
+
+/** @brief  Makes a random block
+ *
+ *  @param  salt    picks the colors, blocks made with the same one share them
+ */
+TestBlock MakeBlock(const BlockShape& shape, Content content, uint32_t salt, std::mt19937& random)
+{
+    const uint32_t pixelBytes = shape.bands * shape.sampleBytes;
+    const uint32_t pixels = shape.x * shape.y;
+
+    TestBlock block;
+
+    //! Random padding on both sides of every row
+    const uint32_t margin = random() % 3;
+    block.stride = static_cast<size_t>(shape.x + 2 * margin) * pixelBytes + random() % 4;
+    block.offset = margin * pixelBytes;
+    block.buffer.resize(block.stride * shape.y + block.offset + pixelBytes);
+
+    for (uint8_t& byte : block.buffer)
+    {
+        byte = static_cast<uint8_t>(random());
+    }
+
+    //! Distinct colors are limited by the bits of a pixel
+    const uint64_t colorLimit = pixelBytes >= 4 ? UINT32_MAX : (1ull << (pixelBytes * 8));
+
+    std::vector<uint32_t> indices(pixels);
+
+    switch (content)
+    {
+        case CONTENT_FEW:
+        {
+            const uint32_t colorCount = 2 + random() % 4;
+
+            for (uint32_t& index : indices)
+            {
+                index = random() % colorCount;
+            }
+
+            break;
+        }
+        case CONTENT_TIE:
+        {
+            for (uint32_t i = 0; i < pixels; ++i)
+            {
+                indices[i] = i < pixels / 2 ? 0 : 1;
+            }
+
+            //! Odd blocks get a third color for the pixel left over
+            if (pixels % 2)
+            {
+                indices[pixels - 1] = 2;
+            }
+
+            std::shuffle(indices.begin(), indices.end(), random);
+            break;
+        }
+        case CONTENT_DISTINCT:
+        {
+            for (uint32_t i = 0; i < pixels; ++i)
+            {
+                indices[i] = static_cast<uint32_t>(i % colorLimit);
+            }
+
+            std::shuffle(indices.begin(), indices.end(), random);
+            break;
+        }
+        case CONTENT_LAST_BYTE:
+        {
+            for (uint32_t& index : indices)
+            {
+                index = random() % 3;
+            }
+
+            break;
+        }
+        default:
+            break;
+    }
+
+    for (uint32_t y = 0; y < shape.y; ++y)
+    {
+        for (uint32_t x = 0; x < shape.x; ++x)
+        {
+            PaintColor(&block.buffer[block.offset + y * block.stride + x * pixelBytes], pixelBytes,
+                indices[y * shape.x + x], content, salt);
+        }
+    }
+
+    return block;
+}
+
+/** @brief  Reference result: counts every pixel, color that gets the most votes first wins
+ *
+ *  @return offset of a pixel of dominant color from the first pixel of the block
+ */
+size_t NaiveDominantColor(const TestBlock& block, const BlockShape& shape)
+{
+    const uint32_t pixelBytes = shape.bands * shape.sampleBytes;
+
+    std::vector<const uint8_t*> colors;
+    std::vector<uint32_t> counts;
+
+    const uint8_t* dominant = block.Pixels();
+    uint32_t domCount = 0;
+
+    for (uint32_t y = 0; y < shape.y; ++y)
+    {
+        for (uint32_t x = 0; x < shape.x; ++x)
+        {
+            const uint8_t* pixel = block.Pixels() + y * block.stride + x * pixelBytes;
+            uint32_t color = 0;
+
+            while (color < colors.size() && 0 != memcmp(colors[color], pixel, pixelBytes))
+            {
+                ++color;
+            }
+
+            if (color == colors.size())
+            {
+                colors.push_back(pixel);
+                counts.push_back(0);
+            }
+
+            if (++counts[color] > domCount)
+            {
+                domCount = counts[color];
+                dominant = pixel;
+            }
+        }
+    }
+
+    return dominant - block.Pixels();
+}
+
+//! Returns kernels to check for @p shape, the portable one first
+std::vector<NamedKernel> KernelsFor(const BlockShape& shape)
+{
+    std::vector<NamedKernel> kernels;
+    kernels.push_back(NamedKernel{ "scalar", &DominantColorScalar });
+
+    if (DominantColorKernel specialized = SpecializedDominantColorKernel(shape))
+    {
+        kernels.push_back(NamedKernel{ "specialized", specialized });
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    const bool simdShape = shape.sampleBytes == 1 && (shape.bands == 3 || shape.bands == 4) &&
+        shape.x * shape.y <= s_simdMaxPixels;
+
+    __builtin_cpu_init();
+
+    if (simdShape && __builtin_cpu_supports("sse4.2"))
+    {
+        kernels.push_back(NamedKernel{ "sse4.2", &DominantColorSse42 });
+    }
+
+    if (simdShape && __builtin_cpu_supports("avx2"))
+    {
+        kernels.push_back(NamedKernel{ "avx2", &DominantColorAvx2 });
+    }
+#endif
+
+    kernels.push_back(NamedKernel{ "selected", SelectDominantColorKernel(shape) });
+
+    return kernels;
+}
+
+//! Prints shape and kernel of a failed check
+void ReportMismatch(const char* what, const BlockShape& shape, Content content, const char* kernel)
+{
+    std::cout << what << ": " << kernel << " kernel, " << shape.x << "x" << shape.y << " blocks of "
+        << shape.bands << " bands of " << shape.sampleBytes << "-byte samples, "
+        << s_contentNames[content] << " colors" << std::endl;
+}
+
+/** @brief  Checks every kernel against the portable one, and the portable one against NaiveDominantColor()
+ *
+ *  @return number of mismatches
+ */
+uint32_t CheckKernels(std::mt19937& random, uint64_t& checks)
+{
+    uint32_t failures = 0;
+    ColorHistogram colors;
+
+    for (const uint32_t* sides : s_blockSides)
+    {
+        for (uint32_t bands : s_bandCounts)
+        {
+            for (uint32_t sampleBytes : s_sampleSizes)
+            {
+                const BlockShape shape = { bands, sampleBytes, sides[0], sides[1] };
+                const uint32_t pixelBytes = bands * sampleBytes;
+                const std::vector<NamedKernel> kernels = KernelsFor(shape);
+
+                colors.Reserve(shape.x * shape.y);
+
+                for (uint32_t content = 0; content < CONTENT_COUNT; ++content)
+                {
+                    bool reported[8] = {};
+
+                    //! Blocks of a case share colors, so whatever a kernel keeps from the previous block would match
+                    const uint32_t salt = random();
+
+                    for (uint32_t i = 0; i < s_blocksPerCase; ++i)
+                    {
+                        const TestBlock block = MakeBlock(shape, static_cast<Content>(content), salt, random);
+
+                        //! Portable kernel is checked against the reference, the rest against the portable one
+                        const uint8_t* expected = block.Pixels() + NaiveDominantColor(block, shape);
+
+                        for (uint32_t k = 0; k < kernels.size(); ++k)
+                        {
+                            const uint8_t* result = kernels[k].kernel(block.Pixels(), block.stride, shape, colors);
+                            ++checks;
+
+                            const bool matches = 0 == memcmp(result, expected, pixelBytes);
+
+                            if (0 == k)
+                            {
+                                expected = result;
+                            }
+
+                            if (!matches)
+                            {
+                                ++failures;
+
+                                //! Once per case is enough to tell what is broken
+                                if (!reported[k])
+                                {
+                                    ReportMismatch(k ? "Differs from scalar kernel" : "Differs from reference",
+                                        shape, static_cast<Content>(content), kernels[k].name);
+                                    reported[k] = true;
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    return failures;
+}
+
+//! Areas of a single color, width and height in pixels, with the block they are split into
+const uint32_t s_uniformAreas[][4] = {
+    //! Narrower or lower than a block, nothing to write
+    { 3, 8, 4, 4 }, { 8, 3, 4, 4 }, { 0, 4, 2, 2 }, { 1, 1, 2, 1 },
+    //! Blocks of one pixel wide, rows of a block hold a single pixel
+    { 1, 4, 1, 2 }, { 5, 6, 1, 3 }, { 1, 1, 1, 1 },
+};
+
+/** @brief  Checks WorkerPool::ProcessArea() on single-color areas of few or no whole blocks
+ *
+ *  Source buffer ends right after the area, so reads past it show up under a memory checker.
+ *
+ *  @return number of mismatches
+ */
+uint32_t CheckUniformAreas(std::mt19937& random, uint64_t& checks)
+{
+    uint32_t failures = 0;
+    WorkerPool pool(1);
+
+    for (const uint32_t* area : s_uniformAreas)
+    {
+        for (uint32_t bands : s_bandCounts)
+        {
+            const BlockShape shape = { bands, 1, area[2], area[3] };
+            const uint32_t pixelBytes = bands;
+            const uint32_t x_tiles = area[0] / shape.x;
+            const uint32_t y_tiles = area[1] / shape.y;
+
+            std::vector<uint8_t> color(pixelBytes);
+
+            for (uint8_t& byte : color)
+            {
+                byte = static_cast<uint8_t>(random());
+            }
+
+            std::vector<uint8_t> pixels(static_cast<size_t>(area[0]) * area[1] * pixelBytes);
+
+            for (size_t i = 0; i < pixels.size(); i += pixelBytes)
+            {
+                memcpy(&pixels[i], color.data(), pixelBytes);
+            }
+
+            //! One pixel more than the result, the last one must stay untouched
+            std::vector<uint8_t> out((x_tiles * y_tiles + 1) * pixelBytes, 0);
+            std::vector<uint8_t> expected(out.size(), 0);
+
+            for (uint32_t i = 0; i < x_tiles * y_tiles; ++i)
+            {
+                memcpy(&expected[i * pixelBytes], color.data(), pixelBytes);
+            }
+
+            pool.ProcessArea(SelectDominantColorKernel(shape), shape, pixels.data(),
+                static_cast<size_t>(area[0]) * pixelBytes, area[0], area[1], out.data(),
+                static_cast<size_t>(x_tiles) * pixelBytes);
+            ++checks;
+
+            if (out != expected)
+            {
+                ++failures;
+                std::cout << "Wrong result of a single-color " << area[0] << "x" << area[1] << " area in "
+                    << shape.x << "x" << shape.y << " blocks of " << bands << " bands" << std::endl;
+            }
+        }
+    }
+
+    return failures;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    //! Fixed seed by default so failures are reproducible, any other can be passed
+    const uint32_t seed = argc > 1 ? strtoul(argv[1], 0, 10) : 2017;
+    std::mt19937 random(seed);
+
+    uint64_t checks = 0;
+    uint32_t failures = CheckKernels(random, checks);
+    failures += CheckUniformAreas(random, checks);
+
+    std::cout << checks << " checks with seed " << seed << ", " << failures << " mismatches" << std::endl;
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}